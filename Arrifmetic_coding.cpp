@@ -1,22 +1,54 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <chrono>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using std::array;
 using std::cerr;
 using std::cout;
-using std::ifstream;
 using std::ofstream;
 using std::string;
 
-/* Запись битов в файл: накапливаем 8 бит -> пишем 1 байт */
+/*
+ * Кодек целиком в пространстве имён arith: файл можно собрать в чужую программу
+ * (с ARITH_NO_MAIN) рядом с кодеком Хаффмана, и одноимённые классы не
+ * столкнутся. Снаружи нужны compressBound / compress / decompressedSize / decompress.
+ */
+namespace arith {
+
+/* Запись битов в память: накапливаем 8 бит -> дописываем 1 байт в буфер */
+template <class Out = std::vector<uint8_t>>
 class BitWriter {
 public:
-    explicit BitWriter(ofstream& out) : out_(out) {}
+    explicit BitWriter(Out& out) : out_(out) {}
 
     void writeBit(bool b) {
         buf_ = (buf_ << 1) | (b ? 1 : 0);
@@ -37,61 +69,451 @@ public:
 
 private:
     void flushByte() {
-        out_.put(static_cast<char>(buf_));
+        out_.push_back(buf_);
         buf_ = 0;
         bits_ = 0;
     }
 
-    ofstream& out_;
+    Out& out_;
     uint8_t buf_{0};
     int bits_{0};
     uint64_t totalBits_{0};
 };
 
-/* Чтение битов из файла: читаем байт и выдаём биты по одному */
+/* Чтение 8 байт старшим байтом вперёд */
+static inline uint64_t loadBE64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * Чтение битов из памяти: 64-битное окно, старший бит — следующий бит потока.
+ * refill() дополняет окно минимум до 56 бит одним чтением 8 байт.
+ * За концом данных читаются нули — так же, как добивка последнего байта.
+ */
 class BitReader {
 public:
-    explicit BitReader(ifstream& in) : in_(in) {}
-
-    bool readBit(bool& bit) {
-        if (bitsLeft_ == 0) {
-            char c;
-            if (!in_.get(c)) return false;
-            buf_ = static_cast<uint8_t>(c);
-            bitsLeft_ = 8;
+    BitReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    void refill() {
+        if (pos_ + 8 <= size_) {
+            acc_ |= loadBE64(data_ + pos_) >> bits_;
+            pos_ += (63 - bits_) >> 3;
+            bits_ |= 56;
+            return;
+        }
+        while (bits_ <= 56) {
+            uint64_t byte = pos_ < size_ ? data_[pos_] : 0;
+            acc_ |= byte << (56 - bits_);
+            pos_++;
+            bits_ += 8;
         }
-        bit = ((buf_ >> (bitsLeft_ - 1)) & 1) != 0;
-        bitsLeft_--;
+    }
+
+    /* Следующие n бит (1 <= n <= 56 после refill) без сдвига позиции */
+    uint64_t peekBits(int n) const { return acc_ >> (64 - n); }
+
+    void consume(int n) {
+        acc_ <<= n;
+        bits_ -= n;
+    }
+
+    /* Один бит; окно пополняется только когда опустело */
+    uint64_t readBit() {
+        if (bits_ == 0) refill();
+        uint64_t bit = acc_ >> 63;
+        consume(1);
+        return bit;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_{0};
+    uint64_t acc_{0};
+    int bits_{0};
+};
+
+/*
+ * Входной файл, отображённый в память: данные читаются прямо из страничного
+ * кэша, без копии в буфер. Система предупреждена о последовательном чтении.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file_, &sz)) return false;
+        size_ = static_cast<size_t>(sz.QuadPart);
+        if (size_ == 0) return true;
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!map_) return false;
+        data_ = static_cast<const uint8_t*>(MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0));
+        return data_ != nullptr;
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return false;
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) return true;
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const uint8_t*>(p);
         return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        map_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
     }
 
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
 private:
-    ifstream& in_;
-    uint8_t buf_{0};
-    int bitsLeft_{0};
+#ifdef _WIN32
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE map_{nullptr};
+#else
+    int fd_{-1};
+#endif
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
 };
 
-/* Чтение файла целиком в память */
-static bool readWholeFile(const string& path, std::vector<uint8_t>& data) {
-    ifstream in(path, std::ios::binary);
-    if (!in) return false;
+/*
+ * Выходной файл заранее известного максимального размера, отображённый в память:
+ * результат пишется прямо в страницы файла. finish() снимает отображение
+ * и обрезает файл до фактического размера.
+ */
+class MappedOutput {
+public:
+    MappedOutput() = default;
+    MappedOutput(const MappedOutput&) = delete;
+    MappedOutput& operator=(const MappedOutput&) = delete;
+    ~MappedOutput() { finish(size_); }
+
+    bool create(const string& path, size_t size) {
+        size_ = size;
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        if (size == 0) return true;
+        uint64_t sz = size;
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+                                  static_cast<DWORD>(sz >> 32), static_cast<DWORD>(sz), nullptr);
+        if (!map_) return false;
+        data_ = static_cast<uint8_t*>(MapViewOfFile(map_, FILE_MAP_WRITE, 0, 0, 0));
+        return data_ != nullptr;
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) return false;
+        if (size == 0) return true;
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) return false;
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        data_ = static_cast<uint8_t*>(p);
+        return true;
+#endif
+    }
+
+    uint8_t* data() { return data_; }
+
+    bool finish(size_t finalSize) {
+        bool ok = true;
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER pos;
+            pos.QuadPart = static_cast<LONGLONG>(finalSize);
+            ok = SetFilePointerEx(file_, pos, nullptr, FILE_BEGIN) && SetEndOfFile(file_);
+            CloseHandle(file_);
+        }
+        map_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap(data_, size_);
+        if (fd_ >= 0) {
+            if (finalSize != size_) ok = ftruncate(fd_, static_cast<off_t>(finalSize)) == 0;
+            ok = (::close(fd_) == 0) && ok;
+        }
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        return ok;
+    }
 
-    in.seekg(0, std::ios::end);
-    std::streamoff sz = in.tellg();
-    in.seekg(0, std::ios::beg);
+private:
+#ifdef _WIN32
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE map_{nullptr};
+#else
+    int fd_{-1};
+#endif
+    uint8_t* data_{nullptr};
+    size_t size_{0};
+};
 
-    data.resize(static_cast<size_t>(sz));
-    if (sz > 0) in.read(reinterpret_cast<char*>(data.data()), sz);
+/*
+ * Выход кодера: буфер в памяти, который по мере заполнения сбрасывается
+ * в поток, — память не растёт с размером файла. Кодеры дописывают в buf()
+ * и время от времени зовут drainIfFull().
+ */
+constexpr size_t SINK_CHUNK = size_t(1) << 20;
 
-    return true;
+class OutputSink {
+public:
+    explicit OutputSink(std::ostream& out) : out_(out) { buf_.reserve(SINK_CHUNK + 4096); }
+
+    std::vector<uint8_t>& buf() { return buf_; }
+
+    void drainIfFull() {
+        if (buf_.size() >= SINK_CHUNK) drain();
+    }
+
+    void drain() {
+        out_.write(reinterpret_cast<const char*>(buf_.data()), static_cast<std::streamsize>(buf_.size()));
+        flushed_ += buf_.size();
+        buf_.clear();
+    }
+
+    uint64_t written() const { return flushed_ + buf_.size(); }
+
+private:
+    std::ostream& out_;
+    std::vector<uint8_t> buf_;
+    uint64_t flushed_{0};
+};
+
+/*
+ * Выход в буфер вызывающего фиксированной ёмкости, для библиотечного
+ * интерфейса: для кодеров выглядит как std::vector, но память не выделяет.
+ * Лишние байты отбрасываются и поднимают флаг overflow(), так что кодер
+ * доходит до конца без проверок в цикле. resize() не проверяет ёмкость —
+ * он только для заголовков в буфере заведомо достаточного размера.
+ */
+class FixedOutput {
+public:
+    FixedOutput(uint8_t* data, size_t capacity) : data_(data), capacity_(capacity) {}
+
+    void push_back(uint8_t b) {
+        if (size_ < capacity_) data_[size_++] = b;
+        else overflow_ = true;
+    }
+
+    void resize(size_t size) { size_ = size; }
+    uint8_t* data() { return data_; }
+    size_t size() const { return size_; }
+    bool overflow() const { return overflow_; }
+
+private:
+    uint8_t* data_;
+    size_t capacity_;
+    size_t size_{0};
+    bool overflow_{false};
+};
+
+/*
+ * Пул из threads потоков на одну операцию: рабочие потоки создаются при первом
+ * run() с несколькими задачами и дальше ждут следующих, вызывающий поток
+ * работает вместе с ними. run(count, fn) выполняет fn(0..count-1): каждый
+ * поток берёт следующий свободный номер, поэтому неравные по времени задачи
+ * распределяются сами. При threads == 1 потоков нет и run() выполняет задачи
+ * на месте, без выделения памяти.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads) : threads_(threads ? threads : 1) {}
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& th : workers_) th.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return threads_; }
+
+    template <class Fn>
+    void run(size_t count, Fn fn) {
+        if (threads_ == 1 || count <= 1) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+        if (workers_.empty()) {
+            for (unsigned t = 1; t < threads_; t++) workers_.emplace_back([this] { loop(); });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = [](void* ctx, size_t i) { (*static_cast<Fn*>(ctx))(i); };
+            ctx_ = &fn;
+            count_ = count;
+            next_ = 0;
+            busy_ = workers_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+        work();
+
+        /* Следующий run() начинается, только когда все рабочие вернулись к ожиданию */
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return busy_ == 0; });
+    }
+
+private:
+    void work() {
+        for (size_t i = next_++; i < count_; i = next_++) task_(ctx_, i);
+    }
+
+    void loop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+
+    unsigned threads_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    void (*task_)(void*, size_t){nullptr};
+    void* ctx_{nullptr};
+    size_t count_{0};
+    std::atomic<size_t> next_{0};
+    size_t busy_{0};
+    uint64_t generation_{0};
+    bool stop_{false};
+};
+
+static unsigned resolveThreads(unsigned threads) {
+    if (threads != 0) return threads;
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+/*
+ * Гистограмма байтов в один поток. Четыре подтаблицы по очереди: подряд
+ * идущие одинаковые байты попадают в разные счётчики и не ждут друг друга
+ * (запись в счётчик и следующее его чтение иначе выстраиваются в цепочку).
+ * Счётчики 32-битные, поэтому вход обрабатывается кусками по HIST_CHUNK байт.
+ */
+constexpr size_t HIST_CHUNK = size_t(1) << 30;
+
+static void countBytes(const uint8_t* p, size_t n, array<uint64_t, 256>& freq) {
+    array<array<uint32_t, 256>, 4> t;
+    while (n > 0) {
+        size_t chunk = n < HIST_CHUNK ? n : HIST_CHUNK;
+        for (array<uint32_t, 256>& row : t) row.fill(0);
+
+        size_t i = 0;
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t w;
+            std::memcpy(&w, p + i, sizeof(w));
+            t[0][w & 0xFF]++;
+            t[1][(w >> 8) & 0xFF]++;
+            t[2][(w >> 16) & 0xFF]++;
+            t[3][(w >> 24) & 0xFF]++;
+            t[0][(w >> 32) & 0xFF]++;
+            t[1][(w >> 40) & 0xFF]++;
+            t[2][(w >> 48) & 0xFF]++;
+            t[3][w >> 56]++;
+        }
+        for (; i < chunk; i++) t[0][p[i]]++;
+
+        for (int s = 0; s < 256; s++) {
+            freq[s] += static_cast<uint64_t>(t[0][s]) + t[1][s] + t[2][s] + t[3][s];
+        }
+        p += chunk;
+        n -= chunk;
+    }
 }
 
-/* Получение размера файла для расчёта коэффициента сжатия */
-static uint64_t fileSize(const string& path) {
-    ifstream in(path, std::ios::binary | std::ios::ate);
-    return in ? static_cast<uint64_t>(in.tellg()) : 0ULL;
+/* Большой вход делится между потоками (не меньше PARALLEL_HIST_MIN байт на поток), частичные гистограммы складываются */
+constexpr size_t PARALLEL_HIST_MIN = size_t(1) << 22;
+
+static void countHistogram(const uint8_t* p, size_t n, WorkerPool& pool, array<uint64_t, 256>& freq) {
+    size_t parts = n / PARALLEL_HIST_MIN;
+    if (parts > pool.size()) parts = pool.size();
+    if (parts <= 1) {
+        countBytes(p, n, freq);
+        return;
+    }
+
+    std::vector<array<uint64_t, 256>> partial(parts);
+    const size_t step = (n + parts - 1) / parts;
+    pool.run(parts, [&](size_t k) {
+        partial[k].fill(0);
+        size_t from = k * step;
+        size_t len = n - from < step ? n - from : step;
+        countBytes(p + from, len, partial[k]);
+    });
+
+    for (const array<uint64_t, 256>& part : partial) {
+        for (int s = 0; s < 256; s++) freq[s] += part[s];
+    }
 }
 
+/* Способ поиска символа по scaled в декодере */
+enum class SymbolSearch { Linear, Binary, Simd, Table };
+
+/*
+ * Движок кодирования: побитовый с E3, байтовый range-кодер, табличный tANS,
+ * чередующийся rANS, range-кодер с адаптивной моделью (один проход) или с PPM,
+ * побитовый context mixing
+ */
+enum class ArithEngine { Bit, Range, Tans, Rans, Adaptive, Ppm, Cm };
+
+/* Параметры из командной строки */
+struct ArithOptions {
+    unsigned threads{0};                // --threads: 0 — по числу ядер
+    ArithEngine engine{ArithEngine::Bit};       // --engine: bit | range | tans | rans | adaptive | ppm | cm
+    uint32_t lanes{8};                          // --lanes: дорожек rANS, 8 или 16
+    uint32_t order{4};                          // --order: порядок PPM, 1..4
+    uint32_t memMb{0};                          // --mem: память моделей PPM/CM, МБ; 0 — по умолчанию
+    uint32_t chunkMb{0};                        // --chunk: куски побитового и range-кодера, МБ; 0 — один поток
+    bool stream{false};                         // --stream: кадры потокового интерфейса (адаптивные движки)
+    SymbolSearch search{SymbolSearch::Table};   // --search: linear | binary | simd | table
+};
+
 /* Построение кумулятивных частот cum и total = сумма всех частот */
 static void buildCum(const array<uint32_t, 256>& freq,
                      array<uint32_t, 257>& cum,
@@ -113,279 +535,2987 @@ static int findSymbol(uint32_t scaled, const array<uint32_t, 257>& cum) {
     return 255;
 }
 
-/* Сжатие (арифметическое кодирование) */
-static void compressArithmetic(const string& inPath, const string& outPath) {
-    using clock = std::chrono::high_resolution_clock;
-    auto t0 = clock::now();
+/* Линейный просмотр cum: до 256 сравнений на символ */
+struct LinearSearch {
+    explicit LinearSearch(const array<uint32_t, 257>& cum) : cum_(cum) {}
 
-    /* 1) Читаем входной файл */
-    std::vector<uint8_t> data;
-    if (!readWholeFile(inPath, data)) {
-        cerr << "Cannot open input: " << inPath << "\n";
-        return;
-    }
-    if (data.empty()) {
-        cerr << "Input is empty.\n";
-        return;
+    int operator()(uint32_t scaled) const { return findSymbol(scaled, cum_); }
+
+    const array<uint32_t, 257>& cum_;
+};
+
+/* Двоичный поиск без ветвлений: 8 шагов, ищем последний s с cum[s] <= scaled */
+struct BinarySearch {
+    explicit BinarySearch(const array<uint32_t, 257>& cum) : cum_(cum) {}
+
+    int operator()(uint32_t scaled) const {
+        int s = 0;
+        for (int step = 128; step > 0; step >>= 1) {
+            s += (cum_[s + step] <= scaled) ? step : 0;
+        }
+        return s;
     }
 
-    /* 2) Строим таблицу частот */
-    array<uint32_t, 256> freq{};
-    for (uint8_t b : data) freq[b]++;
+    const array<uint32_t, 257>& cum_;
+};
 
-    /* 3) Строим cum и total */
-    array<uint32_t, 257> cum{};
-    uint32_t total = 0;
-    buildCum(freq, cum, total);
-    if (total == 0) {
-        cerr << "Bad total.\n";
-        return;
+/*
+ * SIMD: сравниваем scaled сразу с 16 верхними границами cum[s+1], маску
+ * сравнений считаем popcount'ом. Границы возрастают, поэтому первый блок,
+ * где нашлась граница больше scaled, последний. Без SSE2 — двоичный поиск.
+ */
+static inline int popcount16(uint32_t m) {
+    m = m - ((m >> 1) & 0x5555);
+    m = (m & 0x3333) + ((m >> 2) & 0x3333);
+    m = (m + (m >> 4)) & 0x0F0F;
+    return static_cast<int>((m + (m >> 8)) & 0x1F);
+}
+
+struct SimdSearch {
+    explicit SimdSearch(const array<uint32_t, 257>& cum) : fallback_(cum) {
+        for (int s = 0; s < 256; s++) upper_[s] = static_cast<int32_t>(cum[s + 1]);
     }
 
-    /* 4) Константы диапазона для 32-битного кодирования */
-    constexpr uint32_t BITS = 32;
-    constexpr uint64_t MAX_VALUE = (1ULL << BITS) - 1;
-    constexpr uint64_t HALF = (MAX_VALUE / 2) + 1;
-    constexpr uint64_t QUARTER = HALF / 2;
-    constexpr uint64_t THREE_QUARTERS = QUARTER * 3;
+    int operator()(uint32_t scaled) const {
+#if defined(__SSE2__) || defined(_M_X64)
+        /* Границы не больше 2^30, поэтому знаковое сравнение корректно */
+        const __m128i v = _mm_set1_epi32(static_cast<int32_t>(scaled));
+        for (int s = 0; s < 256; s += 16) {
+            const __m128i* p = reinterpret_cast<const __m128i*>(upper_.data() + s);
+            __m128i a = _mm_cmpgt_epi32(_mm_load_si128(p), v);
+            __m128i b = _mm_cmpgt_epi32(_mm_load_si128(p + 1), v);
+            __m128i c = _mm_cmpgt_epi32(_mm_load_si128(p + 2), v);
+            __m128i d = _mm_cmpgt_epi32(_mm_load_si128(p + 3), v);
+            __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+            uint32_t greater = static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+            if (greater != 0) return s + 16 - popcount16(greater);
+        }
+        return 255;
+#else
+        return fallback_(scaled);
+#endif
+    }
 
-    uint64_t low = 0;
-    uint64_t high = MAX_VALUE;
-    uint32_t pending = 0;
+    alignas(16) array<int32_t, 256> upper_{};
+    BinarySearch fallback_;
+};
 
-    /* 5) Открываем выходной файл и пишем заголовок + частоты */
-    ofstream out(outPath, std::ios::binary);
-    if (!out) {
-        cerr << "Cannot create output: " << outPath << "\n";
-        return;
+/* Прямая таблица слот -> символ: одно обращение; строится, если total не больше TABLE_SEARCH_MAX */
+constexpr uint32_t TABLE_SEARCH_MAX = 1u << 16;
+
+struct TableSearch {
+    explicit TableSearch(const array<uint32_t, 257>& cum) {
+        for (int s = 0; s < 256; s++) {
+            const uint32_t end = std::min(cum[s + 1], TABLE_SEARCH_MAX);
+            for (uint32_t k = cum[s]; k < end; k++) slot_[k] = static_cast<uint8_t>(s);
+        }
     }
 
-    const uint32_t magic = 0x41524331;          // идентификатор формата
-    const uint32_t origSize = static_cast<uint32_t>(data.size());
+    int operator()(uint32_t scaled) const { return slot_[scaled]; }
 
-    uint64_t encodedBitCount = 0;
+    array<uint8_t, TABLE_SEARCH_MAX> slot_;     // занято первые total ячеек
+};
 
-    out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
-    out.write(reinterpret_cast<const char*>(&origSize), sizeof(origSize));
-    out.write(reinterpret_cast<const char*>(freq.data()), sizeof(uint32_t) * 256);
+/*
+ * Деление на сумму частот в побитовом кодере: произвольная сумма (старый
+ * формат с сырыми частотами) или степень двойки — тогда это сдвиг.
+ */
+struct DivScale {
+    uint32_t total;
+    uint64_t of(uint64_t x) const { return x / total; }
+};
 
-    /* 6) Резервируем место под encodedBitCount (заполним после кодирования) */
-    std::streampos bitCountPos = out.tellp();
-    out.write(reinterpret_cast<const char*>(&encodedBitCount), sizeof(encodedBitCount));
+struct ShiftScale {
+    uint32_t total;
+    uint32_t bits;
+    uint64_t of(uint64_t x) const { return x >> bits; }
+};
 
-    BitWriter bw(out);
+/*
+ * Состояние побитового кодера: 32 бита, границы половин и четвертей и сужение
+ * интервала. range * cum помещается в 64 бита и делится после умножения.
+ */
+struct BitState {
+    static constexpr uint32_t BITS = 32;
+    static constexpr uint64_t MAX_VALUE = (1ULL << BITS) - 1;
+    static constexpr uint64_t HALF = (MAX_VALUE / 2) + 1;
+    static constexpr uint64_t QUARTER = HALF / 2;
+    static constexpr uint64_t THREE_QUARTERS = QUARTER * 3;
+
+    /* Сужение [low, high] до подынтервала символа [cumLow, cumHigh) */
+    template <class Scale>
+    static void narrow(uint64_t& low, uint64_t& high, uint32_t cumLow, uint32_t cumHigh, const Scale& scale) {
+        const uint64_t range = high - low + 1;
+        high = low + scale.of(range * cumHigh) - 1;
+        low = low + scale.of(range * cumLow);
+    }
 
-    /* Функция вывода “стабильного” бита + обработка pending (underflow) */
-    auto outputBit = [&](bool bit) {
-        bw.writeBit(bit);
-        while (pending > 0) {
-            bw.writeBit(!bit);
-            pending--;
-        }
-    };
+    /* Позиция value внутри [low, high] в шкале [0..total) */
+    template <class Scale>
+    static uint32_t point(uint64_t low, uint64_t high, uint64_t value, const Scale& scale) {
+        const uint64_t range = high - low + 1;
+        return static_cast<uint32_t>(((value - low + 1) * scale.total - 1) / range);
+    }
+};
 
-    /* 7) Основной цикл кодирования по символам */
-    for (uint8_t sym : data) {
-        uint64_t range = high - low + 1;
-        uint32_t s = sym;
+/* Основной цикл декодирования: ровно origSize байт, символ ищет find(scaled) */
+template <class Finder, class Scale>
+static void decodeSymbols(BitReader& br, const array<uint32_t, 257>& cum, const Scale& scale,
+                          uint8_t* result, uint64_t origSize, const Finder& find) {
+    uint64_t low = 0;
+    uint64_t high = BitState::MAX_VALUE;
 
-        /* Сужение интервала под символ s */
-        uint64_t newHigh = low + (range * cum[s + 1]) / total - 1;
-        uint64_t newLow  = low + (range * cum[s])     / total;
-        low = newLow;
-        high = newHigh;
+    /* Инициализация value первыми BITS битами (по 32 за чтение окна) */
+    uint64_t value = 0;
+    for (uint32_t left = BitState::BITS; left > 0;) {
+        const int take = static_cast<int>(left < 32 ? left : 32);
+        br.refill();
+        value = (value << take) | br.peekBits(take);
+        br.consume(take);
+        left -= static_cast<uint32_t>(take);
+    }
 
-        /* Нормализация интервала и выдача битов */
+    for (uint64_t produced = 0; produced < origSize; produced++) {
+        /* По позиции value выбираем символ */
+        int sym = find(BitState::point(low, high, value, scale));
+        result[produced] = static_cast<uint8_t>(sym);
+
+        /* Обновляем интервал под найденный символ */
+        BitState::narrow(low, high, cum[sym], cum[sym + 1], scale);
+
+        /* Нормализация и подтягивание новых битов в value */
         while (true) {
-            if (high < HALF) {
-                outputBit(false);
-            } else if (low >= HALF) {
-                outputBit(true);
-                low -= HALF;
-                high -= HALF;
-            } else if (low >= QUARTER && high < THREE_QUARTERS) {
-                pending++;
-                low -= QUARTER;
-                high -= QUARTER;
+            if (high < BitState::HALF) {
+            } else if (low >= BitState::HALF) {
+                low -= BitState::HALF;
+                high -= BitState::HALF;
+                value -= BitState::HALF;
+            } else if (low >= BitState::QUARTER && high < BitState::THREE_QUARTERS) {
+                low -= BitState::QUARTER;
+                high -= BitState::QUARTER;
+                value -= BitState::QUARTER;
             } else {
                 break;
             }
 
             low <<= 1;
             high = (high << 1) | 1;
+            value = (value << 1) | br.readBit();
         }
     }
+}
 
-    /* 8) Финализация: вывод завершающих битов */
-    pending++;
-    if (low < QUARTER) outputBit(false);
-    else outputBit(true);
+/* Выбор поиска символа и вызов fn с ним; таблица строится только для малых total */
+template <class Fn>
+static void withFinder(SymbolSearch search, const array<uint32_t, 257>& cum, uint32_t total, Fn fn) {
+    if (search == SymbolSearch::Table && total > TABLE_SEARCH_MAX) search = SymbolSearch::Binary;
 
-    /* 9) Закрываем битовый поток */
-    bw.flushFinal();
+    switch (search) {
+    case SymbolSearch::Linear: fn(LinearSearch(cum)); break;
+    case SymbolSearch::Binary: fn(BinarySearch(cum)); break;
+    case SymbolSearch::Simd:   fn(SimdSearch(cum)); break;
+    case SymbolSearch::Table:  fn(TableSearch(cum)); break;
+    }
+}
 
-    /* 10) Записываем реальное число бит (encodedBitCount) в заголовок */
-    encodedBitCount = bw.totalBits();
-    out.seekp(bitCountPos);
-    out.write(reinterpret_cast<const char*>(&encodedBitCount), sizeof(encodedBitCount));
-    out.close();
+/*
+ * Идентификаторы форматов: побитовый кодер (сырые частоты — только чтение старых
+ * файлов), байтовый range-кодер, tANS, rANS, адаптивный range-кодер, PPM, CM,
+ * побитовый кодер с нормированными частотами,
+ * несжимаемые данные как есть
+ */
+constexpr uint32_t MAGIC_BIT = 0x41524331;
+constexpr uint32_t MAGIC_BIT_NORM = 0x41524338;
+constexpr uint32_t MAGIC_RANGE = 0x41524332;
+constexpr uint32_t MAGIC_TANS = 0x41524333;
+constexpr uint32_t MAGIC_RANS = 0x41524334;
+constexpr uint32_t MAGIC_ADAPTIVE = 0x41524335;
+constexpr uint32_t MAGIC_PPM = 0x41524336;
+constexpr uint32_t MAGIC_CM = 0x41524337;
+constexpr uint32_t MAGIC_STORED = 0x4152433A;
+
+/* Сумма частот range-кодера — 2^15: деление на total заменяется сдвигом */
+constexpr uint32_t RANGE_TOTAL_BITS = 15;
+
+/* То же для побитового кодера */
+constexpr uint32_t BIT_TOTAL_BITS = 15;
+
+/* Запись целого числа по 7 бит, старший бит байта — «есть продолжение» */
+template <class Out>
+static void putVarint(Out& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
 
-    /* 11) Статистика */
-    auto t1 = clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+static bool readVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) return false;
+        uint8_t byte = *p++;
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
 
-    uint64_t inSz = data.size();
-    uint64_t outSz = fileSize(outPath);
-    double ratio = (1.0 - (double)outSz / (double)inSz) * 100.0;
+/*
+ * Контейнер второй редакции, общий для всех движков: magic, код движка (u8 —
+ * младший байт его прежнего magic; старший бит — поток разбит на независимые
+ * куски), origSize (u64), дальше поля движка.
+ * Прежние форматы с 32-битным origSize по-прежнему читаются.
+ */
+constexpr uint32_t MAGIC_CONTAINER = 0x41524358;
+constexpr size_t CONTAINER_SIZE_POS = 5;
+constexpr size_t CONTAINER_HEADER = 13;
+constexpr uint8_t ENGINE_CHUNKED = 0x80;        // флаг в коде движка: независимые куски
+
+/* origSize для потока, длина которого при записи заголовка неизвестна: поток самозавершающийся */
+constexpr uint64_t SIZE_STREAMED = ~uint64_t(0);
+
+template <class Out>
+static void putHeader(Out& out, uint32_t engineMagic, uint64_t origSize, bool chunked = false) {
+    const size_t pos = out.size();
+    out.resize(pos + CONTAINER_HEADER);
+    std::memcpy(out.data() + pos, &MAGIC_CONTAINER, sizeof(MAGIC_CONTAINER));
+    out.data()[pos + 4] = static_cast<uint8_t>(static_cast<uint8_t>(engineMagic) | (chunked ? ENGINE_CHUNKED : 0));
+    std::memcpy(out.data() + pos + CONTAINER_SIZE_POS, &origSize, sizeof(origSize));
+}
 
-    cout << "Compressed OK\n";
-    cout << "Input:  " << inSz << " bytes\n";
-    cout << "Output: " << outSz << " bytes\n";
-    cout << "Compression: " << ratio << "%\n";
-    cout << "Time: " << ms << " ms\n";
+/* 256 нормированных частот по u16 */
+template <class Out>
+static void putFreq16(Out& out, const array<uint32_t, 256>& norm) {
+    const size_t pos = out.size();
+    out.resize(pos + sizeof(uint16_t) * 256);
+    for (int i = 0; i < 256; i++) {
+        uint16_t f = static_cast<uint16_t>(norm[i]);
+        std::memcpy(out.data() + pos + i * sizeof(f), &f, sizeof(f));
+    }
 }
 
-/* Распаковка (арифметическое декодирование) */
-static void decompressArithmetic(const string& inPath, const string& outPath) {
-    using clock = std::chrono::high_resolution_clock;
-    auto t0 = clock::now();
+/*
+ * Разреженная таблица частот: varint число встречавшихся символов, затем для
+ * каждого varint пропуск от предыдущего символа и varint (частота - 1).
+ * Для текста из нескольких десятков символов это меньше сотни байт.
+ */
+template <class Out>
+static void putFreqTable(Out& out, const array<uint32_t, 256>& freq) {
+    uint32_t present = 0;
+    for (int i = 0; i < 256; i++) present += freq[i] != 0;
+    putVarint(out, present);
+
+    int prev = -1;
+    for (int i = 0; i < 256; i++) {
+        if (freq[i] == 0) continue;
+        putVarint(out, static_cast<uint64_t>(i - prev - 1));
+        putVarint(out, freq[i] - 1);
+        prev = i;
+    }
+}
 
-    /* 1) Открываем входной файл */
-    ifstream in(inPath, std::ios::binary);
-    if (!in) {
-        cerr << "Cannot open input: " << inPath << "\n";
-        return;
+static bool readFreqTable(const uint8_t*& p, const uint8_t* end, array<uint32_t, 256>& freq) {
+    uint64_t present = 0;
+    if (!readVarint(p, end, present) || present > 256) return false;
+
+    freq.fill(0);
+    uint64_t sym = 0;
+    for (uint64_t k = 0; k < present; k++) {
+        uint64_t gap = 0, f = 0;
+        if (!readVarint(p, end, gap) || !readVarint(p, end, f)) return false;
+        sym += gap;
+        if (sym > 255 || f >= 0xFFFFFFFFu) return false;
+        freq[sym++] = static_cast<uint32_t>(f + 1);
     }
+    return true;
+}
 
-    /* 2) Читаем заголовок */
-    uint32_t magic = 0;
-    uint32_t origSize = 0;
+/* Пока range не меньше 2^24, старший байт ещё не определён */
+constexpr uint32_t RANGE_TOP = 1u << 24;
 
-    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
-    in.read(reinterpret_cast<char*>(&origSize), sizeof(origSize));
-    if (!in || magic != 0x41524331) {
-        cerr << "Bad format.\n";
-        return;
+/* a * b / c без переполнения: счётчики 64-битные, b не больше 2^15 */
+static inline uint64_t mulDiv(uint64_t a, uint64_t b, uint64_t c) {
+    return (a / c) * b + (a % c) * b / c;
+}
+
+/*
+ * Нормировка частот к сумме 2^totalBits. Каждый встречавшийся символ
+ * получает не меньше 1, ошибку округления забирает самый частый символ.
+ */
+static void normalizeFreq(const array<uint64_t, 256>& freq, uint32_t totalBits, array<uint32_t, 256>& norm) {
+    const uint64_t target = uint64_t(1) << totalBits;
+    uint64_t sum = 0;
+    for (int i = 0; i < 256; i++) sum += freq[i];
+
+    int64_t assigned = 0;
+    for (int i = 0; i < 256; i++) {
+        norm[i] = 0;
+        if (freq[i] == 0) continue;
+        uint64_t scaled = mulDiv(freq[i], target, sum);
+        norm[i] = scaled > 0 ? static_cast<uint32_t>(scaled) : 1;
+        assigned += norm[i];
     }
 
-    /* 3) Читаем таблицу частот и encodedBitCount */
-    array<uint32_t, 256> freq{};
-    in.read(reinterpret_cast<char*>(freq.data()), sizeof(uint32_t) * 256);
+    /* Излишек от округления вверх снимаем с самых частых, недостачу отдаём самому частому */
+    int64_t diff = static_cast<int64_t>(target) - assigned;
+    while (diff != 0) {
+        int top = 0;
+        for (int i = 1; i < 256; i++) {
+            if (norm[i] > norm[top]) top = i;
+        }
+        if (diff > 0) {
+            norm[top] += static_cast<uint32_t>(diff);
+            diff = 0;
+        } else {
+            int64_t take = std::min<int64_t>(-diff, norm[top] - 1);
+            norm[top] -= static_cast<uint32_t>(take);
+            diff += take;
+        }
+    }
+}
 
-    uint64_t encodedBitCount = 0;
-    in.read(reinterpret_cast<char*>(&encodedBitCount), sizeof(encodedBitCount));
-    if (!in) {
-        cerr << "Header read error.\n";
-        return;
+/*
+ * Источник байтов для декодеров: буфер в памяти или поток, который читается
+ * кусками по мере надобности (канал, сокет). За концом данных — нули, как и
+ * в BitReader. head — байты, уже прочитанные из потока вместе с заголовком.
+ */
+constexpr size_t INPUT_CHUNK = size_t(1) << 16;
+
+class ByteInput {
+public:
+    ByteInput(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    ByteInput(std::istream& in, const uint8_t* head, size_t headSize)
+        : buf_(head, head + headSize), in_(&in) {
+        data_ = buf_.data();
+        size_ = buf_.size();
     }
 
-    /* 4) Восстанавливаем cum и total */
-    array<uint32_t, 257> cum{};
-    uint32_t total = 0;
-    buildCum(freq, cum, total);
-    if (total == 0) {
-        cerr << "Bad total.\n";
-        return;
+    uint32_t next() { return pos_ < size_ ? data_[pos_++] : refill(); }
+
+private:
+    uint32_t refill() {
+        if (in_ == nullptr) return 0;
+        buf_.resize(INPUT_CHUNK);
+        in_->read(reinterpret_cast<char*>(buf_.data()), static_cast<std::streamsize>(buf_.size()));
+        data_ = buf_.data();
+        size_ = static_cast<size_t>(in_->gcount());
+        pos_ = 0;
+        if (size_ == 0) {
+            in_ = nullptr;
+            return 0;
+        }
+        return data_[pos_++];
     }
 
-    /* 5) Константы диапазона */
-    constexpr uint32_t BITS = 32;
-    constexpr uint64_t MAX_VALUE = (1ULL << BITS) - 1;
-    constexpr uint64_t HALF = (MAX_VALUE / 2) + 1;
-    constexpr uint64_t QUARTER = HALF / 2;
-    constexpr uint64_t THREE_QUARTERS = QUARTER * 3;
+    std::vector<uint8_t> buf_;
+    std::istream* in_{nullptr};
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+    size_t pos_{0};
+};
 
-    uint64_t low = 0;
-    uint64_t high = MAX_VALUE;
-    uint64_t value = 0;
+/*
+ * Байтовый range-кодер (Субботин/LZMA): low — 33 бита с переносом, range — 32 бита.
+ * Нормализация выдаёт сразу байт, пока range < 2^24. Перенос в уже выданные
+ * байты не нужен: старший байт задерживается в cache, за ним копится
+ * счётчик байтов 0xFF, и перенос дописывается к ним при выдаче.
+ */
+template <class Out = std::vector<uint8_t>>
+class RangeEncoder {
+public:
+    explicit RangeEncoder(Out& out) : out_(out) {}
+
+    /* Сужение интервала под символ [cumLow, cumLow + freq) из суммы 2^totalBits */
+    void encode(uint32_t cumLow, uint32_t freq, uint32_t totalBits) {
+        uint32_t r = range_ >> totalBits;
+        low_ += static_cast<uint64_t>(r) * cumLow;
+        range_ = r * freq;
+        normalize();
+    }
 
-    BitReader br(in);
-    uint64_t bitsRead = 0;
+    /* То же для произвольной суммы total (адаптивные модели): деление вместо сдвига */
+    void encodeTotal(uint32_t cumLow, uint32_t freq, uint32_t total) {
+        uint32_t r = range_ / total;
+        low_ += static_cast<uint64_t>(r) * cumLow;
+        range_ = r * freq;
+        normalize();
+    }
 
-    /* Чтение одного бита с учётом encodedBitCount (лишнее добиваем нулями) */
-    auto readOneBit = [&]() -> uint64_t {
-        bool bit = false;
-        if (bitsRead < encodedBitCount && br.readBit(bit)) {
-            bitsRead++;
-            return bit ? 1ULL : 0ULL;
+    /* Служебное поле из bits равновероятных бит, по 8 за шаг */
+    void encodeRaw(uint32_t v, uint32_t bits) {
+        while (bits > 0) {
+            uint32_t take = bits < 8 ? bits : 8;
+            bits -= take;
+            encode((v >> bits) & ((1u << take) - 1), 1, take);
         }
-        bitsRead++;
-        return 0ULL;
-    };
+    }
 
-    /* 6) Инициализация value первыми 32 битами */
-    for (uint32_t i = 0; i < BITS; i++) value = (value << 1) | readOneBit();
+    /* Выталкиваем все байты low */
+    void flush() {
+        for (int i = 0; i < 5; i++) shiftLow();
+    }
 
-    /* 7) Открываем выходной файл */
-    ofstream out(outPath, std::ios::binary);
-    if (!out) {
-        cerr << "Cannot create output: " << outPath << "\n";
-        return;
+private:
+    void normalize() {
+        while (range_ < RANGE_TOP) {
+            range_ <<= 8;
+            shiftLow();
+        }
     }
 
-    /* 8) Основной цикл восстановления: ровно origSize байт */
-    for (uint32_t produced = 0; produced < origSize; produced++) {
-        uint64_t range = high - low + 1;
+    void shiftLow() {
+        if (static_cast<uint32_t>(low_) < 0xFF000000u || (low_ >> 32) != 0) {
+            uint8_t carry = static_cast<uint8_t>(low_ >> 32);
+            uint8_t byte = cache_;
+            do {
+                out_.push_back(static_cast<uint8_t>(byte + carry));
+                byte = 0xFF;
+            } while (--cacheSize_ != 0);
+            cache_ = static_cast<uint8_t>(low_ >> 24);
+        }
+        cacheSize_++;
+        low_ = (low_ & 0x00FFFFFFu) << 8;
+    }
 
-        /* scaled показывает позицию value внутри [low, high] в шкале [0..total) */
-        uint64_t scaled = ((value - low + 1) * total - 1) / range;
+    Out& out_;
+    uint64_t low_{0};
+    uint32_t range_{0xFFFFFFFFu};
+    uint8_t cache_{0};
+    uint64_t cacheSize_{1};
+};
 
-        /* По scaled выбираем символ */
-        int sym = findSymbol(static_cast<uint32_t>(scaled), cum);
-        out.put(static_cast<char>(static_cast<uint8_t>(sym)));
+/* Декодер к RangeEncoder: code — смещение точки потока от low */
+class RangeDecoder {
+public:
+    RangeDecoder(const uint8_t* data, size_t size) : in_(data, size) { init(); }
+    explicit RangeDecoder(ByteInput in) : in_(std::move(in)) { init(); }
+
+    /* Положение точки в шкале [0, 2^totalBits) */
+    uint32_t decodeFreq(uint32_t totalBits) {
+        r_ = range_ >> totalBits;
+        uint32_t v = code_ / r_;
+        uint32_t top = (1u << totalBits) - 1;
+        return v < top ? v : top;
+    }
 
-        /* Обновляем интервал под найденный символ */
-        uint64_t newHigh = low + (range * cum[sym + 1]) / total - 1;
-        uint64_t newLow  = low + (range * cum[sym])     / total;
-        low = newLow;
-        high = newHigh;
+    /* Положение точки в шкале [0, total) для произвольной суммы */
+    uint32_t decodeFreqTotal(uint32_t total) {
+        r_ = range_ / total;
+        uint32_t v = code_ / r_;
+        return v < total - 1 ? v : total - 1;
+    }
 
-        /* Нормализация и подтягивание новых битов в value */
-        while (true) {
-            if (high < HALF) {
-            } else if (low >= HALF) {
-                low -= HALF;
-                high -= HALF;
-                value -= HALF;
-            } else if (low >= QUARTER && high < THREE_QUARTERS) {
-                low -= QUARTER;
-                high -= QUARTER;
-                value -= QUARTER;
-            } else {
-                break;
-            }
+    /* Сужение интервала под найденный символ и подкачка байтов */
+    void decodeUpdate(uint32_t cumLow, uint32_t freq) {
+        code_ -= r_ * cumLow;
+        range_ = r_ * freq;
+        while (range_ < RANGE_TOP) {
+            code_ = (code_ << 8) | in_.next();
+            range_ <<= 8;
+        }
+    }
 
-            low <<= 1;
-            high = (high << 1) | 1;
-            value = (value << 1) | readOneBit();
+    uint32_t decodeRaw(uint32_t bits) {
+        uint32_t v = 0;
+        while (bits > 0) {
+            uint32_t take = bits < 8 ? bits : 8;
+            bits -= take;
+            uint32_t part = decodeFreq(take);
+            decodeUpdate(part, 1);
+            v = (v << take) | part;
         }
+        return v;
     }
 
-    out.close();
+private:
+    void init() {
+        for (int i = 0; i < 5; i++) code_ = (code_ << 8) | in_.next();
+    }
 
-    /* 9) Время выполнения */
-    auto t1 = clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    ByteInput in_;
+    uint32_t code_{0};
+    uint32_t range_{0xFFFFFFFFu};
+    uint32_t r_{0};
+};
 
-    cout << "Decompressed OK\n";
-    cout << "Time: " << ms << " ms\n";
+/* Цикл декодирования range-потока: ровно origSize байт */
+template <class Finder>
+static void decodeRangeSymbols(RangeDecoder& rd, const array<uint32_t, 257>& cum,
+                               uint8_t* result, uint64_t origSize, const Finder& find) {
+    for (uint64_t produced = 0; produced < origSize; produced++) {
+        int sym = find(rd.decodeFreq(RANGE_TOTAL_BITS));
+        result[produced] = static_cast<uint8_t>(sym);
+        rd.decodeUpdate(cum[sym], cum[sym + 1] - cum[sym]);
+    }
 }
 
-/* Меню программы: выбор режима и ввод имён файлов */
-int main() {
-    cout << "1) Compress (Arithmetic)\n2) Decompress (Arithmetic)\nChoose: ";
-    int choice = 0;
-    std::cin >> choice;
+/*
+ * Кумулятивные частоты алфавита из N символов в дереве Фенвика: сумма частот
+ * до символа и обновление счётчика — за O(log N), поиск символа по точке —
+ * спуском по степеням двойки, тоже O(log N). Так адаптивная модель не
+ * пересчитывает все N накопленных сумм на каждом символе, и 16-битные
+ * алфавиты токенов стоят почти столько же, сколько байтовый.
+ */
+template <size_t N>
+class FenwickFreq {
+public:
+    FenwickFreq() : freq_(N, 0), tree_(N + 1, 0) {}
 
-    string inFile, outFile;
-    cout << "Input file: ";
-    std::cin >> inFile;
+    uint32_t total() const { return total_; }
+    uint32_t freq(size_t s) const { return freq_[s]; }
+
+    /* Сумма частот символов 0..s-1 */
+    uint32_t cumLow(size_t s) const {
+        uint32_t c = 0;
+        for (size_t i = s; i > 0; i &= i - 1) c += tree_[i];
+        return c;
+    }
+
+    void add(size_t s, uint32_t delta) {
+        freq_[s] += delta;
+        total_ += delta;
+        for (size_t i = s + 1; i <= N; i += i & (~i + 1)) tree_[i] += delta;
+    }
+
+    /* Символ, в интервал которого попала точка (point < total); cumLow — начало интервала */
+    size_t find(uint32_t point, uint32_t& cumLow) const {
+        size_t pos = 0;
+        uint32_t rest = point;
+        for (size_t step = TOP; step > 0; step >>= 1) {
+            if (pos + step <= N && tree_[pos + step] <= rest) {
+                pos += step;
+                rest -= tree_[pos];
+            }
+        }
+        cumLow = point - rest;
+        return pos;
+    }
+
+    /* Новые частоты f(старая) для всех символов и перестройка дерева за O(N) */
+    template <class Fn>
+    void rebuild(Fn f) {
+        total_ = 0;
+        for (size_t s = 0; s < N; s++) {
+            freq_[s] = f(freq_[s]);
+            total_ += freq_[s];
+            tree_[s + 1] = freq_[s];
+        }
+        for (size_t i = 1; i <= N; i++) {
+            size_t parent = i + (i & (~i + 1));
+            if (parent <= N) tree_[parent] += tree_[i];
+        }
+    }
+
+private:
+    /* Старшая степень двойки, не превосходящая N */
+    static constexpr size_t topBit(size_t n) { return n < 2 ? n : 2 * topBit(n / 2); }
+    static constexpr size_t TOP = topBit(N);
+
+    std::vector<uint32_t> freq_;
+    std::vector<uint32_t> tree_;
+    uint32_t total_{0};
+};
+
+/*
+ * Адаптивная модель порядка 0: счётчики стартуют с 1, растут на ADAPT_INC
+ * после каждого символа и делятся пополам, когда сумма превышает предел
+ * (ADAPT_LIMIT для байтов; для больших алфавитов — до 2^20, чтобы после
+ * деления счётчикам оставалось куда расти, а range-кодеру хватало точности).
+ * Кодер и декодер обновляют модель одинаково, поэтому таблица частот в файл
+ * не пишется, а кодирование начинается с первого прочитанного байта.
+ */
+constexpr uint32_t ADAPT_INC = 24;
+constexpr uint32_t ADAPT_LIMIT = 1u << 16;
+
+template <size_t N>
+class AdaptiveFreqModel {
+public:
+    static constexpr uint32_t LIMIT = N * 16 <= ADAPT_LIMIT ? ADAPT_LIMIT
+                                    : N * 16 <= (1u << 20) ? static_cast<uint32_t>(N * 16) : (1u << 20);
+    static_assert(N >= 2 && N * 4 <= LIMIT, "alphabet too large for the range coder");
+
+    AdaptiveFreqModel() {
+        freq_.rebuild([](uint32_t) { return 1u; });
+    }
+
+    uint32_t total() const { return freq_.total(); }
+    uint32_t freq(int s) const { return freq_.freq(static_cast<size_t>(s)); }
+    uint32_t cumLow(int s) const { return freq_.cumLow(static_cast<size_t>(s)); }
+
+    int find(uint32_t point, uint32_t& cumLow) const {
+        return static_cast<int>(freq_.find(point, cumLow));
+    }
+
+    void update(int s) {
+        freq_.add(static_cast<size_t>(s), ADAPT_INC);
+        /* Половина счётчика, но не меньше 1: символ остаётся кодируемым */
+        if (freq_.total() > LIMIT) freq_.rebuild([](uint32_t f) { return (f + 1) >> 1; });
+    }
+
+    /* Кодирование символа и обновление модели */
+    void encode(RangeEncoder<>& rc, int s) {
+        rc.encodeTotal(cumLow(s), freq(s), total());
+        update(s);
+    }
+
+    int decode(RangeDecoder& rd) {
+        uint32_t c = 0;
+        int s = find(rd.decodeFreqTotal(total()), c);
+        rd.decodeUpdate(c, freq(s));
+        update(s);
+        return s;
+    }
+
+private:
+    FenwickFreq<N> freq_;
+};
+
+using AdaptiveModel = AdaptiveFreqModel<256>;
+
+/*
+ * PPM порядков 1..4 поверх того же range-кодера. Контекст порядка k — последние
+ * k байт; для каждого порядка своя таблица узлов. Узел хранит до PPM_NODE_SYMS
+ * встреченных символов со счётчиками; при переполнении вытесняется самый редкий.
+ * Если символа в узле нет, кодируется escape (частота — PPM_ESC на каждый символ
+ * узла, половина приращения счётчика) и модель переходит к порядку ниже; символы, уже отвергнутые старшими
+ * порядками, исключаются из шкалы. Порядок 0 — 256 счётчиков, escape не нужен.
+ *
+ * Таблицы порядков делят бюджет памяти поровну сверху вниз: порядку, которому
+ * хватает 256^k узлов, таблица индексируется контекстом напрямую, остальные
+ * хешируются, а при коллизии узел перезаписывается.
+ */
+constexpr uint32_t PPM_MAX_ORDER = 4;
+constexpr uint32_t PPM_DEFAULT_MB = 64;
+constexpr uint32_t PPM_NODE_SYMS = 32;
+constexpr uint32_t PPM_INC = 16;
+constexpr uint32_t PPM_ESC = 8;
+constexpr uint32_t PPM_NODE_LIMIT = 1u << 13;
+
+struct PpmNode {
+    uint32_t key;
+    uint16_t total;
+    uint8_t count;
+    array<uint8_t, PPM_NODE_SYMS> sym;
+    array<uint16_t, PPM_NODE_SYMS> freq;
+};
+
+class PpmModel {
+public:
+    PpmModel(uint32_t order, size_t memBytes) : order_(order) {
+        size_t remaining = memBytes;
+        for (uint32_t k = 1; k <= order_; k++) {
+            const uint64_t contexts = uint64_t(1) << (8 * k);
+            size_t share = remaining / (order_ - k + 1) / sizeof(PpmNode);
+            size_t size = 1;
+            while (size * 2 <= share && size < contexts) size *= 2;
+            tables_[k].assign(size, PpmNode{});
+            direct_[k] = size == contexts;
+            remaining -= std::min(remaining, size * sizeof(PpmNode));
+        }
+        order0_.fill(1);
+    }
+
+    /* Байт памяти под таблицы контекстов */
+    size_t memoryBytes() const {
+        size_t bytes = sizeof(order0_);
+        for (uint32_t k = 1; k <= order_; k++) bytes += tables_[k].size() * sizeof(PpmNode);
+        return bytes;
+    }
+
+    void encode(RangeEncoder<>& rc, int s) {
+        beginSymbol();
+        uint32_t k = order_;
+        for (; k >= 1; k--) {
+            const PpmNode* node = ctx_[k];
+            if (node == nullptr) continue;
+
+            uint32_t cum = 0, total = 0, escape = 0, found = 0, f = 0;
+            for (uint32_t i = 0; i < node->count; i++) {
+                if (excluded(node->sym[i])) continue;
+                if (node->sym[i] == s) {
+                    found = 1;
+                    cum = total;
+                    f = node->freq[i];
+                }
+                total += node->freq[i];
+                escape++;
+            }
+            if (escape == 0) continue;
+            escape *= PPM_ESC;
+            if (found) {
+                rc.encodeTotal(cum, f, total + escape);
+                break;
+            }
+            rc.encodeTotal(total, escape, total + escape);
+            exclude(*node);
+        }
+        if (k == 0) {
+            uint32_t cum = 0, total = 0;
+            for (int i = 0; i < 256; i++) {
+                if (excluded(i)) continue;
+                if (i == s) cum = total;
+                total += order0_[i];
+            }
+            rc.encodeTotal(cum, order0_[s], total);
+        }
+        update(s, k);
+    }
+
+    int decode(RangeDecoder& rd) {
+        beginSymbol();
+        uint32_t k = order_;
+        int s = -1;
+        for (; k >= 1; k--) {
+            const PpmNode* node = ctx_[k];
+            if (node == nullptr) continue;
+
+            uint32_t total = 0, escape = 0;
+            for (uint32_t i = 0; i < node->count; i++) {
+                if (excluded(node->sym[i])) continue;
+                total += node->freq[i];
+                escape++;
+            }
+            if (escape == 0) continue;
+            escape *= PPM_ESC;
+
+            uint32_t point = rd.decodeFreqTotal(total + escape);
+            if (point >= total) {
+                rd.decodeUpdate(total, escape);
+                exclude(*node);
+                continue;
+            }
+            uint32_t cum = 0;
+            for (uint32_t i = 0; i < node->count; i++) {
+                if (excluded(node->sym[i])) continue;
+                if (point < cum + node->freq[i]) {
+                    s = node->sym[i];
+                    rd.decodeUpdate(cum, node->freq[i]);
+                    break;
+                }
+                cum += node->freq[i];
+            }
+            break;
+        }
+        if (k == 0) {
+            uint32_t total = 0;
+            for (int i = 0; i < 256; i++) {
+                if (!excluded(i)) total += order0_[i];
+            }
+            uint32_t point = rd.decodeFreqTotal(total);
+            uint32_t cum = 0;
+            for (int i = 0; i < 256; i++) {
+                if (excluded(i)) continue;
+                if (point < cum + order0_[i] || i == 255) {
+                    s = i;
+                    break;
+                }
+                cum += order0_[i];
+            }
+            rd.decodeUpdate(cum, order0_[s]);
+        }
+        update(s, k);
+        return s;
+    }
+
+private:
+    /* Узлы текущих контекстов; nullptr — контекст ещё не встречался или вытеснен */
+    void beginSymbol() {
+        stamp_++;
+        for (uint32_t k = 1; k <= order_; k++) {
+            const uint32_t key = k == 4 ? hist_ : hist_ & ((1u << (8 * k)) - 1);
+            PpmNode& node = tables_[k][slot(k, key)];
+            slot_[k] = &node;
+            ctx_[k] = node.count != 0 && node.key == key ? &node : nullptr;
+            keys_[k] = key;
+        }
+    }
+
+    size_t slot(uint32_t k, uint32_t key) const {
+        if (direct_[k]) return key;
+        return static_cast<size_t>((uint64_t(key * 0x9E3779B1u) * tables_[k].size()) >> 32);
+    }
+
+    bool excluded(int s) const { return mark_[s] == stamp_; }
+
+    void exclude(const PpmNode& node) {
+        for (uint32_t i = 0; i < node.count; i++) mark_[node.sym[i]] = stamp_;
+    }
+
+    /* Символ закодирован порядком coded: он и все старшие порядки узнают о нём */
+    void update(int s, uint32_t coded) {
+        for (uint32_t k = std::max<uint32_t>(coded, 1); k <= order_; k++) {
+            PpmNode& node = *slot_[k];
+            if (ctx_[k] == nullptr) {
+                node.key = keys_[k];
+                node.count = 0;
+                node.total = 0;
+            }
+            addSymbol(node, s);
+        }
+
+        order0_[s] += PPM_INC;
+        order0Total_ += PPM_INC;
+        if (order0Total_ > ADAPT_LIMIT) {
+            order0Total_ = 0;
+            for (uint32_t& f : order0_) {
+                f = (f + 1) >> 1;
+                order0Total_ += f;
+            }
+        }
+        hist_ = (hist_ << 8) | static_cast<uint32_t>(s);
+    }
+
+    static void addSymbol(PpmNode& node, int s) {
+        uint32_t i = 0;
+        while (i < node.count && node.sym[i] != s) i++;
+        if (i == node.count) {
+            if (node.count < PPM_NODE_SYMS) {
+                node.count++;
+            } else {
+                i = 0;
+                for (uint32_t j = 1; j < PPM_NODE_SYMS; j++) {
+                    if (node.freq[j] < node.freq[i]) i = j;
+                }
+                node.total -= node.freq[i];
+            }
+            node.sym[i] = static_cast<uint8_t>(s);
+            node.freq[i] = 0;
+        }
+        node.freq[i] += PPM_INC;
+        node.total += PPM_INC;
+        if (node.total > PPM_NODE_LIMIT) {
+            node.total = 0;
+            for (uint32_t j = 0; j < node.count; j++) {
+                node.freq[j] = static_cast<uint16_t>((node.freq[j] + 1) >> 1);
+                node.total += node.freq[j];
+            }
+        }
+    }
+
+    uint32_t order_;
+    array<std::vector<PpmNode>, PPM_MAX_ORDER + 1> tables_;
+    array<bool, PPM_MAX_ORDER + 1> direct_{};
+    array<PpmNode*, PPM_MAX_ORDER + 1> slot_{};
+    array<const PpmNode*, PPM_MAX_ORDER + 1> ctx_{};
+    array<uint32_t, PPM_MAX_ORDER + 1> keys_{};
+    array<uint32_t, 256> order0_{};
+    uint32_t order0Total_{256};
+    array<uint32_t, 256> mark_{};
+    uint32_t stamp_{0};
+    uint32_t hist_{0};
+};
+
+/*
+ * Двоичный арифметический кодер для CM: тот же 32-битный интервал [low, high],
+ * что и в побитовом кодере, но делится он по вероятности единицы p (12 бит),
+ * а наружу сразу уходит байт, как только старшие байты low и high совпали.
+ * Переносов нет: interval никогда не пересекает границу, которую уже выдали.
+ */
+class BinaryEncoder {
+public:
+    explicit BinaryEncoder(std::vector<uint8_t>& out) : out_(out) {}
+
+    void encode(int bit, int p1) {
+        const uint32_t mid = low_ + static_cast<uint32_t>((uint64_t(high_ - low_) * static_cast<uint32_t>(p1)) >> 12);
+        if (bit) high_ = mid;
+        else low_ = mid + 1;
+        while (((low_ ^ high_) & 0xFF000000u) == 0) {
+            out_.push_back(static_cast<uint8_t>(high_ >> 24));
+            low_ <<= 8;
+            high_ = (high_ << 8) | 0xFF;
+        }
+    }
+
+    void encodeRaw(uint32_t v, uint32_t bits) {
+        while (bits-- > 0) encode((v >> bits) & 1, 2048);
+    }
+
+    /* Любая точка интервала годится: выдаём low целиком */
+    void flush() {
+        for (int i = 0; i < 4; i++) {
+            out_.push_back(static_cast<uint8_t>(low_ >> 24));
+            low_ <<= 8;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint32_t low_{0};
+    uint32_t high_{0xFFFFFFFFu};
+};
+
+class BinaryDecoder {
+public:
+    BinaryDecoder(const uint8_t* data, size_t size) : in_(data, size) { init(); }
+    explicit BinaryDecoder(ByteInput in) : in_(std::move(in)) { init(); }
+
+    int decode(int p1) {
+        const uint32_t mid = low_ + static_cast<uint32_t>((uint64_t(high_ - low_) * static_cast<uint32_t>(p1)) >> 12);
+        const int bit = x_ <= mid;
+        if (bit) high_ = mid;
+        else low_ = mid + 1;
+        while (((low_ ^ high_) & 0xFF000000u) == 0) {
+            low_ <<= 8;
+            high_ = (high_ << 8) | 0xFF;
+            x_ = (x_ << 8) | in_.next();
+        }
+        return bit;
+    }
+
+    uint32_t decodeRaw(uint32_t bits) {
+        uint32_t v = 0;
+        while (bits-- > 0) v = (v << 1) | static_cast<uint32_t>(decode(2048));
+        return v;
+    }
+
+private:
+    void init() {
+        for (int i = 0; i < 4; i++) x_ = (x_ << 8) | in_.next();
+    }
+
+    ByteInput in_;
+    uint32_t low_{0};
+    uint32_t high_{0xFFFFFFFFu};
+    uint32_t x_{0};
+};
+
+/*
+ * Логистическая область: stretch(p) = ln(p / (1 - p)), squash — обратная.
+ * p — 12 бит, stretch — от -2047 до 2047 (8 бит дробной части).
+ * squash интерполирует по 33 узлам, stretch — таблица обращения squash.
+ */
+static int squash(int d) {
+    static const int t[33] = {1,    2,    3,    6,    10,   16,   27,   45,   73,   120,  194,
+                              310,  488,  747,  1101, 1546, 2047, 2549, 2994, 3348, 3607, 3785,
+                              3901, 3975, 4022, 4050, 4068, 4079, 4085, 4089, 4092, 4093, 4094};
+    if (d > 2047) return 4095;
+    if (d < -2047) return 1;
+    const int w = d & 127;
+    d = (d >> 7) + 16;
+    return (t[d] * (128 - w) + t[d + 1] * w + 64) >> 7;
+}
+
+static const array<int16_t, 4096>& stretchTable() {
+    static const array<int16_t, 4096> table = [] {
+        array<int16_t, 4096> t{};
+        int pi = 0;
+        for (int x = -2047; x <= 2047; x++) {
+            int v = squash(x);
+            for (int j = pi; j <= v; j++) t[j] = static_cast<int16_t>(x);
+            pi = v + 1;
+        }
+        for (int j = pi; j < 4096; j++) t[j] = 2047;
+        return t;
+    }();
+    return table;
+}
+
+/*
+ * Счётчик вероятности в 16 битах: старшие 12 — p(1), младшие 4 — число
+ * наблюдений n. Шаг обновления 1/(n + 1.5): новый контекст учится быстро,
+ * устоявшийся — медленно, не медленнее 1/(CM_LIMIT + 1.5).
+ */
+constexpr uint32_t CM_LIMIT = 14;
+constexpr uint16_t CM_COUNTER_INIT = 2048 << 4;
+
+static inline int counterP(uint16_t c) { return c >> 4; }
+
+static inline void counterUpdate(uint16_t& c, int bit) {
+    static const array<int32_t, 16> rec = [] {
+        array<int32_t, 16> r{};
+        for (int n = 0; n < 16; n++) r[n] = static_cast<int32_t>(65536.0 / (n + 1.5));
+        return r;
+    }();
+    const int n = c & 15;
+    int p = c >> 4;
+    p += (((bit ? 4095 : 0) - p) * rec[n]) >> 16;
+    c = static_cast<uint16_t>((p << 4) | (n < static_cast<int>(CM_LIMIT) ? n + 1 : n));
+}
+
+/*
+ * APM/SSE: уточнение вероятности по контексту. Для каждого контекста 33 узла
+ * по оси stretch(p); ответ — интерполяция соседних узлов, учится ближайший.
+ */
+class Apm {
+public:
+    explicit Apm(size_t contexts) : t_(contexts * 33) {
+        for (size_t i = 0; i < t_.size(); i++) {
+            t_[i] = static_cast<uint16_t>(squash((static_cast<int>(i % 33) - 16) * 128) * 16);
+        }
+    }
+
+    int p(int pr, size_t ctx) {
+        const int s = stretchTable()[pr] + 2048;
+        const int w = s & 127;
+        index_ = static_cast<size_t>(s >> 7) + ctx * 33;
+        const int r = (t_[index_] * (128 - w) + t_[index_ + 1] * w) >> 11;
+        if (w >= 64) index_++;
+        return r < 1 ? 1 : (r > 4095 ? 4095 : r);
+    }
+
+    void update(int bit) {
+        const int g = (bit << 16) + (bit << 7) - bit - bit;
+        t_[index_] = static_cast<uint16_t>(t_[index_] + ((g - t_[index_]) >> 7));
+    }
+
+private:
+    std::vector<uint16_t> t_;
+    size_t index_{0};
+};
+
+/*
+ * Побитовый context mixing в духе lpaq. Байт кодируется восемью двоичными
+ * решениями, старший бит первым. Предсказывают:
+ *   - контекстные модели порядков 1, 2, 3, 4, 6 и модель слова (хеш букв
+ *     с начала слова);
+ *   - модель совпадений: последнее вхождение текущих CM_MATCH_MIN байт
+ *     в истории и бит байта, который шёл за ним.
+ * Входы stretch(p) смешивает однослойная сеть с весами, выбранными по уже
+ * известным битам байта (c0); сеть учится онлайн на ошибке кодирования.
+ * Результат уточняют два APM: по c0 и по c0 с предыдущим байтом.
+ *
+ * Счётчики контекстной модели лежат строками по 16 штук (32 байта): в строке
+ * все 15 узлов дерева одного полубайта и 16-битная метка контекста. Строка
+ * выбирается хешем в начале полубайта, поэтому на модель приходится один
+ * промах кэша на 4 бита; при несовпадении метки строка сбрасывается.
+ * Таблицы делят бюджет --mem; по умолчанию CM_DEFAULT_MB, чтобы всё
+ * помещалось в L2/L3 и промахи не уходили в память.
+ */
+constexpr uint32_t CM_MODELS = 6;
+constexpr uint32_t CM_INPUTS = CM_MODELS + 2;   // + модель совпадений + смещение
+constexpr uint32_t CM_DEFAULT_MB = 16;
+constexpr uint32_t CM_MATCH_MIN = 6;
+constexpr uint32_t CM_MATCH_MAX = 31;
+constexpr int CM_MIXER_SHIFT = 11;
+
+struct alignas(32) CmLine {
+    array<uint16_t, 16> slot;                   // slot[0] — метка контекста
+};
+
+class CmModel {
+public:
+    explicit CmModel(size_t memBytes) : apm1_(256), apm2_(1u << 16) {
+        /* Половина бюджета — контекстные модели, четверть — история и хеш совпадений */
+        size_t lines = 1;
+        while (lines * 2 * sizeof(CmLine) * CM_MODELS <= memBytes / 2) lines *= 2;
+        lineMask_ = lines - 1;
+        for (std::vector<CmLine>& t : tables_) t.assign(lines, CmLine{});
+
+        size_t buf = size_t(1) << 16;
+        while (buf * 2 <= memBytes / 8) buf *= 2;
+        buf_.assign(buf, 0);
+        matchTable_.assign(buf / 4, 0);
+
+        weights_.assign(256 * CM_INPUTS, 1 << 14);
+        matchCounters_.fill(CM_COUNTER_INIT);
+        beginByte();
+        beginNibble();
+    }
+
+    size_t memoryBytes() const {
+        return tables_.size() * tables_[0].size() * sizeof(CmLine) + buf_.size() +
+               matchTable_.size() * sizeof(uint32_t) + weights_.size() * sizeof(int32_t);
+    }
+
+    void encode(BinaryEncoder& bc, int s) {
+        for (int i = 7; i >= 0; i--) {
+            const int bit = (s >> i) & 1;
+            bc.encode(bit, predict());
+            update(bit);
+        }
+    }
+
+    int decode(BinaryDecoder& bd) {
+        for (int i = 0; i < 8; i++) update(bd.decode(predict()));
+        return c1_;
+    }
+
+private:
+    int predict() {
+        const array<int16_t, 4096>& st = stretchTable();
+        for (uint32_t i = 0; i < CM_MODELS; i++) {
+            counter_[i] = &line_[i]->slot[nibble_];
+            inputs_[i] = st[counterP(*counter_[i])];
+        }
+
+        /* Совпадение ещё живо, пока известные биты байта равны битам ожидаемого */
+        matchCounter_ = nullptr;
+        inputs_[CM_MODELS] = 0;
+        if (matchLen_ > 0 && ((expected_ | 0x100) >> (8 - bitPos_)) == c0_) {
+            const int bit = (expected_ >> (7 - bitPos_)) & 1;
+            matchCounter_ = &matchCounters_[std::min(matchLen_, 15u) * 2 + bit];
+            inputs_[CM_MODELS] = st[counterP(*matchCounter_)];
+        }
+        inputs_[CM_MODELS + 1] = 256;
+
+        int64_t dot = 0;
+        const int32_t* w = &weights_[c0_ * CM_INPUTS];
+        for (uint32_t i = 0; i < CM_INPUTS; i++) dot += static_cast<int64_t>(inputs_[i]) * w[i];
+        int d = static_cast<int>(dot >> 16);
+        d = d < -2047 ? -2047 : (d > 2047 ? 2047 : d);
+        prMix_ = squash(d);
+
+        const int p1 = apm1_.p(prMix_, c0_);
+        const int p2 = apm2_.p(prMix_, c0_ | (c1_ << 8));
+        const int pr = (prMix_ + p1 + 2 * p2 + 2) >> 2;
+        return pr < 1 ? 1 : (pr > 4095 ? 4095 : pr);
+    }
+
+    void update(int bit) {
+        for (uint32_t i = 0; i < CM_MODELS; i++) counterUpdate(*counter_[i], bit);
+        if (matchCounter_ != nullptr) counterUpdate(*matchCounter_, bit);
+
+        const int err = (bit << 12) - prMix_;
+        int32_t* w = &weights_[c0_ * CM_INPUTS];
+        for (uint32_t i = 0; i < CM_INPUTS; i++) w[i] += (inputs_[i] * err) >> CM_MIXER_SHIFT;
+
+        apm1_.update(bit);
+        apm2_.update(bit);
+
+        c0_ = (c0_ << 1) | static_cast<uint32_t>(bit);
+        nibble_ = (nibble_ << 1) | static_cast<uint32_t>(bit);
+        bitPos_++;
+        if (bitPos_ == 8) {
+            endByte(static_cast<uint8_t>(c0_));
+            beginByte();
+            beginNibble();
+        } else if (bitPos_ == 4) {
+            beginNibble();
+        }
+    }
+
+    /* Байт закончен: история, модель слова и поиск совпадения */
+    void endByte(uint8_t c) {
+        c1_ = c;
+        c8_ = (c8_ << 8) | (c4_ >> 24);
+        c4_ = (c4_ << 8) | c;
+
+        const size_t mask = buf_.size() - 1;
+        buf_[pos_ & mask] = c;
+        pos_++;
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80) {
+            word_ = (word_ + static_cast<uint32_t>(c | 0x20)) * 0x2F0F1E5Du;
+        } else {
+            word_ = 0;
+        }
+
+        if (matchLen_ > 0 && expected_ == c) {
+            matchLen_ = std::min(matchLen_ + 1, CM_MATCH_MAX);
+            matchPtr_++;
+        } else {
+            matchLen_ = 0;
+        }
+        const size_t h = static_cast<size_t>(
+            (hashOf(static_cast<uint64_t>(c4_) | (static_cast<uint64_t>(c8_ & 0xFFFF) << 32), 7) >> 32) &
+            (matchTable_.size() - 1));
+        if (matchLen_ == 0 && pos_ >= CM_MATCH_MIN) {
+            uint32_t ptr = matchTable_[h];
+            if (ptr != 0 && pos_ - ptr < buf_.size()) {
+                uint32_t len = 0;
+                while (len < CM_MATCH_MAX && len < ptr &&
+                       buf_[(ptr - len - 1) & mask] == buf_[(pos_ - len - 1) & mask]) {
+                    len++;
+                }
+                if (len >= CM_MATCH_MIN) {
+                    matchLen_ = len;
+                    matchPtr_ = ptr;
+                }
+            }
+        }
+        matchTable_[h] = pos_;
+        if (matchLen_ > 0) expected_ = buf_[matchPtr_ & mask];
+    }
+
+    /* Хеши контекстов на границе байта: порядки 1, 2, 3, 4, 6 и слово */
+    void beginByte() {
+        c0_ = 1;
+        bitPos_ = 0;
+        const uint64_t c6 = static_cast<uint64_t>(c4_) | (static_cast<uint64_t>(c8_ & 0xFFFF) << 32);
+        ctx_[0] = hashOf(c4_ & 0xFF, 1);
+        ctx_[1] = hashOf(c4_ & 0xFFFF, 2);
+        ctx_[2] = hashOf(c4_ & 0xFFFFFF, 3);
+        ctx_[3] = hashOf(c4_, 4);
+        ctx_[4] = hashOf(c6, 6);
+        ctx_[5] = hashOf(static_cast<uint64_t>(word_) << 8 | (c4_ & 0xFF), 9);
+    }
+
+    /* Строка счётчиков полубайта: хеш контекста и уже известного полубайта */
+    void beginNibble() {
+        nibble_ = 1;
+        for (uint32_t i = 0; i < CM_MODELS; i++) {
+            const uint64_t h = hashOf(ctx_[i] + c0_, i);
+            CmLine& line = tables_[i][static_cast<size_t>(h) & lineMask_];
+            const uint16_t tag = static_cast<uint16_t>(h >> 48);
+            if (line.slot[0] != tag) {
+                line.slot.fill(CM_COUNTER_INIT);
+                line.slot[0] = tag;
+            }
+            line_[i] = &line;
+        }
+    }
+
+    static uint64_t hashOf(uint64_t x, uint64_t salt) {
+        x = (x + salt * 0x9E3779B97F4A7C15ull) * 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 31;
+        return x * 0x94D049BB133111EBull;
+    }
+
+    array<std::vector<CmLine>, CM_MODELS> tables_;
+    size_t lineMask_{0};
+    array<CmLine*, CM_MODELS> line_{};
+    array<uint16_t*, CM_MODELS> counter_{};
+    array<uint64_t, CM_MODELS> ctx_{};
+
+    std::vector<uint8_t> buf_;
+    std::vector<uint32_t> matchTable_;
+    array<uint16_t, 32> matchCounters_{};
+    uint16_t* matchCounter_{nullptr};
+    uint32_t matchPtr_{0};
+    uint32_t matchLen_{0};
+    uint32_t expected_{0};
+
+    std::vector<int32_t> weights_;
+    array<int, CM_INPUTS> inputs_{};
+    int prMix_{2048};
+    Apm apm1_;
+    Apm apm2_;
+
+    uint32_t c0_{1};
+    uint32_t nibble_{1};
+    uint32_t bitPos_{0};
+    uint32_t c1_{0};
+    uint32_t c4_{0};
+    uint32_t c8_{0};
+    uint32_t word_{0};
+    uint32_t pos_{0};
+};
+
+/* Размер таблицы tANS — 2^12 состояний; сумма нормированных частот та же */
+constexpr uint32_t TANS_TABLE_LOG = 12;
+constexpr uint32_t TANS_TABLE_SIZE = 1u << TANS_TABLE_LOG;
+
+/* Номер старшего единичного бита, v > 0 */
+static inline uint32_t highBit(uint32_t v) {
+    uint32_t r = 0;
+    while (v >>= 1) r++;
+    return r;
+}
+
+/*
+ * Раскладка символов по таблице tANS (как в FSE): шаг нечётный, поэтому
+ * обходит все 2^L ячеек, а одинаковые символы оказываются разбросаны.
+ */
+static void spreadSymbols(const array<uint32_t, 256>& norm, array<uint8_t, TANS_TABLE_SIZE>& spread) {
+    const uint32_t size = TANS_TABLE_SIZE;
+    const uint32_t mask = size - 1;
+    const uint32_t step = (size >> 1) + (size >> 3) + 3;
+
+    spread.fill(0);
+    uint32_t pos = 0;
+    for (int s = 0; s < 256; s++) {
+        for (uint32_t i = 0; i < norm[s]; i++) {
+            spread[pos] = static_cast<uint8_t>(s);
+            pos = (pos + step) & mask;
+        }
+    }
+}
+
+/* Переход кодера для символа: число бит считается из состояния одним сдвигом */
+struct TansSymbol {
+    uint32_t deltaNbBits;       // nbBits = (state + deltaNbBits) >> 16
+    int32_t deltaFindState;     // индекс в stateTable = (state >> nbBits) + deltaFindState
+};
+
+/*
+ * Таблицы кодера. Состояние x лежит в [2^L, 2^(L+1)); для символа s с частотой f
+ * сдвигаем x вправо, пока он не попадёт в [f, 2f), и по результату берём
+ * следующее состояние из stateTable — только сдвиги и обращения к таблицам.
+ */
+struct TansEncoderTable {
+    explicit TansEncoderTable(const array<uint32_t, 256>& norm) {
+        const uint32_t size = TANS_TABLE_SIZE;
+        array<uint8_t, TANS_TABLE_SIZE> spread;
+        spreadSymbols(norm, spread);
+
+        array<uint32_t, 257> cum{};
+        uint32_t total = 0;
+        buildCum(norm, cum, total);
+
+        /* k-е вхождение символа s в таблицу — состояние cum[s] + k */
+        array<uint32_t, 256> next{};
+        for (int s = 0; s < 256; s++) next[s] = cum[s];
+        for (uint32_t u = 0; u < size; u++) {
+            stateTable[next[spread[u]]++] = static_cast<uint16_t>(size + u);
+        }
+
+        for (int s = 0; s < 256; s++) {
+            uint32_t f = norm[s];
+            if (f == 0) continue;
+            if (f == 1) {
+                symbols[s].deltaNbBits = (TANS_TABLE_LOG << 16) - size;
+            } else {
+                uint32_t maxBitsOut = TANS_TABLE_LOG - highBit(f - 1);
+                uint32_t minStatePlus = f << maxBitsOut;
+                symbols[s].deltaNbBits = (maxBitsOut << 16) - minStatePlus;
+            }
+            symbols[s].deltaFindState = static_cast<int32_t>(cum[s]) - static_cast<int32_t>(f);
+        }
+    }
+
+    array<uint16_t, TANS_TABLE_SIZE> stateTable{};
+    array<TansSymbol, 256> symbols{};
+};
+
+/* Ячейка таблицы декодера: символ, сколько бит дочитать и база следующего состояния */
+struct TansDecodeEntry {
+    uint16_t newStateBase;
+    uint8_t symbol;
+    uint8_t nbBits;
+};
+
+using TansDecodeTable = array<TansDecodeEntry, TANS_TABLE_SIZE>;
+
+static void buildTansDecodeTable(const array<uint32_t, 256>& norm, TansDecodeTable& table) {
+    const uint32_t size = TANS_TABLE_SIZE;
+    array<uint8_t, TANS_TABLE_SIZE> spread;
+    spreadSymbols(norm, spread);
+
+    array<uint32_t, 256> next = norm;
+    for (uint32_t u = 0; u < size; u++) {
+        uint8_t s = spread[u];
+        uint32_t x = next[s]++;                             // x в [f, 2f)
+        uint32_t nbBits = TANS_TABLE_LOG - highBit(x);
+        table[u].symbol = s;
+        table[u].nbBits = static_cast<uint8_t>(nbBits);
+        table[u].newStateBase = static_cast<uint16_t>((x << nbBits) - size);
+    }
+}
+
+/*
+ * Запись битов младшим битом вперёд. tANS кодирует с конца входа, а декодер
+ * читает поток с конца назад, поэтому поток закрывается единичным битом-меткой.
+ */
+class LsbBitWriter {
+public:
+    explicit LsbBitWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+    void writeBits(uint32_t value, uint32_t n) {
+        acc_ |= static_cast<uint64_t>(value) << count_;
+        count_ += n;
+        while (count_ >= 8) {
+            out_.push_back(static_cast<uint8_t>(acc_));
+            acc_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    /* Бит-метка и неполный последний байт */
+    void finish() {
+        writeBits(1, 1);
+        if (count_ > 0) out_.push_back(static_cast<uint8_t>(acc_));
+        acc_ = 0;
+        count_ = 0;
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint64_t acc_{0};
+    uint32_t count_{0};
+};
+
+/* Чтение потока LsbBitWriter от метки к началу; при нехватке данных — нули */
+class BackwardBitReader {
+public:
+    BackwardBitReader(const uint8_t* data, size_t size) : data_(data), size_(size) {
+        if (size_ > 0 && data_[size_ - 1] != 0) {
+            pos_ = (size_ - 1) * 8 + highBit(data_[size_ - 1]);
+            valid_ = true;
+        }
+    }
+
+    bool valid() const { return valid_; }
+
+    /* n <= 16 бит, лежащих перед текущей позицией */
+    uint32_t readBits(uint32_t n) {
+        if (n > pos_) {
+            pos_ = 0;
+            return 0;
+        }
+        pos_ -= n;
+        size_t byte = pos_ >> 3;
+        uint32_t v;
+        if (byte + 3 <= size_) {
+            v = data_[byte] | (uint32_t(data_[byte + 1]) << 8) | (uint32_t(data_[byte + 2]) << 16);
+        } else {
+            v = 0;
+            for (size_t i = 0; i < 3 && byte + i < size_; i++) v |= uint32_t(data_[byte + i]) << (8 * i);
+        }
+        return (v >> (pos_ & 7)) & ((1u << n) - 1);
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_{0};
+    bool valid_{false};
+};
+
+/*
+ * Чередующийся rANS: N независимых 32-битных состояний (8 или 16), символ i
+ * кодируется состоянием i % N, нормализация — 16-битными словами из общего
+ * потока. Декодер читает слова по порядку дорожек, поэтому AVX2 (8 дорожек
+ * за шаг) и AVX-512 (16) дают тот же поток, что и скалярный цикл.
+ * Векторные пути включаются флагами компилятора (-mavx2 / -mavx512f).
+ */
+constexpr uint32_t RANS_PROB_BITS = 12;
+constexpr uint32_t RANS_L = 1u << 16;           // нижняя граница состояния
+constexpr uint32_t RANS_MAX_LANES = 16;
+
+/* Ячейка таблицы декодера: (freq - 1) | (slot - start) << 12 | symbol << 24 */
+using RansDecodeTable = array<uint32_t, 1u << RANS_PROB_BITS>;
+
+static void buildRansDecodeTable(const array<uint32_t, 256>& norm, RansDecodeTable& table) {
+    uint32_t start = 0;
+    for (uint32_t s = 0; s < 256; s++) {
+        for (uint32_t k = 0; k < norm[s]; k++) {
+            table[start + k] = (norm[s] - 1) | (k << 12) | (s << 24);
+        }
+        start += norm[s];
+    }
+}
+
+/* Следующее 16-битное слово потока (little-endian); за концом — нули */
+static inline uint32_t ransWord(const uint8_t*& w, const uint8_t* end) {
+    if (w + 2 > end) return 0;
+    uint32_t v = w[0] | (uint32_t(w[1]) << 8);
+    w += 2;
+    return v;
+}
+
+/* Скалярное декодирование символов [from, origSize) */
+static void decodeRansScalar(array<uint32_t, RANS_MAX_LANES>& x, uint32_t lanes, const uint8_t*& w,
+                             const uint8_t* end, const RansDecodeTable& table,
+                             uint8_t* result, size_t from, uint64_t origSize) {
+    for (size_t i = from; i < origSize; i++) {
+        uint32_t& st = x[i % lanes];
+        uint32_t e = table[st & ((1u << RANS_PROB_BITS) - 1)];
+        result[i] = static_cast<uint8_t>(e >> 24);
+        st = ((e & 0xFFF) + 1) * (st >> RANS_PROB_BITS) + ((e >> 12) & 0xFFF);
+        if (st < RANS_L) st = (st << 16) | ransWord(w, end);
+    }
+}
+
+#if defined(__AVX2__)
+/* Для маски дорожек, которым нужно слово: дорожка j берёт слово номер popcount(mask & ((1 << j) - 1)) */
+static const array<array<int32_t, 8>, 256>& ransExpandLut() {
+    static const array<array<int32_t, 8>, 256> lut = [] {
+        array<array<int32_t, 8>, 256> t{};
+        for (int m = 0; m < 256; m++) {
+            int k = 0;
+            for (int j = 0; j < 8; j++) {
+                t[m][j] = k;
+                if (m & (1 << j)) k++;
+            }
+        }
+        return t;
+    }();
+    return lut;
+}
+
+/* По 8 дорожек за шаг; 16 дорожек — двумя половинами подряд, порядок чтения тот же. Возвращает число символов */
+static size_t decodeRansAvx2(array<uint32_t, RANS_MAX_LANES>& x, uint32_t lanes, const uint8_t*& w,
+                             const uint8_t* end, const RansDecodeTable& table,
+                             uint8_t* result, uint64_t origSize) {
+    const auto& lut = ransExpandLut();
+    const __m256i slotMask = _mm256_set1_epi32((1 << RANS_PROB_BITS) - 1);
+    const __m256i low12 = _mm256_set1_epi32(0xFFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i zero = _mm256_setzero_si256();
+    const int* tab = reinterpret_cast<const int*>(table.data());
+    const uint32_t halves = lanes / 8;
+
+    __m256i st[2];
+    for (uint32_t h = 0; h < halves; h++) st[h] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x.data() + 8 * h));
+
+    size_t i = 0;
+    while (i + lanes <= origSize && end - w >= static_cast<ptrdiff_t>(2 * lanes)) {
+        for (uint32_t h = 0; h < halves; h++) {
+            __m256i s = st[h];
+            __m256i e = _mm256_i32gather_epi32(tab, _mm256_and_si256(s, slotMask), 4);
+
+            /* Символы: 8 младших байтов после двух упаковок с насыщением */
+            __m256i sym = _mm256_srli_epi32(e, 24);
+            __m256i b = _mm256_packus_epi16(_mm256_packus_epi32(sym, sym), zero);
+            uint32_t lo = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(b)));
+            uint32_t hi = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(b, 1)));
+            std::memcpy(result + i + 8 * h, &lo, 4);
+            std::memcpy(result + i + 8 * h + 4, &hi, 4);
+
+            /* x = freq * (x >> 12) + (slot - start) */
+            __m256i freq = _mm256_add_epi32(_mm256_and_si256(e, low12), one);
+            __m256i bias = _mm256_and_si256(_mm256_srli_epi32(e, 12), low12);
+            s = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(s, RANS_PROB_BITS)), bias);
+
+            /* Нормализация: дорожкам с x < 2^16 раздаём очередные слова по порядку */
+            __m256i need = _mm256_cmpeq_epi32(_mm256_srli_epi32(s, 16), zero);
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(need));
+            __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w)));
+            __m256i perm = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut[mask].data()));
+            __m256i refill = _mm256_or_si256(_mm256_slli_epi32(s, 16), _mm256_permutevar8x32_epi32(words, perm));
+            st[h] = _mm256_blendv_epi8(s, refill, need);
+            w += 2 * popcount16(static_cast<uint32_t>(mask));
+        }
+        i += lanes;
+    }
+
+    for (uint32_t h = 0; h < halves; h++) _mm256_storeu_si256(reinterpret_cast<__m256i*>(x.data() + 8 * h), st[h]);
+    return i;
+}
+#endif
+
+#if defined(__AVX512F__)
+/* 16 дорожек за шаг: слова раздаются инструкцией expand по маске. Возвращает число символов */
+static size_t decodeRansAvx512(array<uint32_t, RANS_MAX_LANES>& x, const uint8_t*& w,
+                               const uint8_t* end, const RansDecodeTable& table,
+                               uint8_t* result, uint64_t origSize) {
+    const __m512i slotMask = _mm512_set1_epi32((1 << RANS_PROB_BITS) - 1);
+    const __m512i low12 = _mm512_set1_epi32(0xFFF);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i lowBound = _mm512_set1_epi32(static_cast<int>(RANS_L));
+
+    /* Формы с маской всех дорожек: в формах без маски GCC 12 берёт источником
+       _mm512_undefined_epi32() и выдаёт -Wmaybe-uninitialized */
+    const __mmask16 all = 0xFFFF;
+    __m512i s = _mm512_loadu_si512(x.data());
+
+    size_t i = 0;
+    while (i + 16 <= origSize && end - w >= 32) {
+        __m512i e = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), all, _mm512_and_si512(s, slotMask),
+                                                table.data(), 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(result + i),
+                         _mm512_maskz_cvtepi32_epi8(all, _mm512_maskz_srli_epi32(all, e, 24)));
+
+        __m512i freq = _mm512_add_epi32(_mm512_and_si512(e, low12), one);
+        __m512i bias = _mm512_and_si512(_mm512_maskz_srli_epi32(all, e, 12), low12);
+        s = _mm512_add_epi32(_mm512_maskz_mullo_epi32(all, freq, _mm512_maskz_srli_epi32(all, s, RANS_PROB_BITS)), bias);
+
+        __mmask16 need = _mm512_cmplt_epu32_mask(s, lowBound);
+        __m512i words = _mm512_maskz_expand_epi32(need,
+            _mm512_maskz_cvtepu16_epi32(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w))));
+        s = _mm512_mask_or_epi32(s, need, _mm512_maskz_slli_epi32(all, s, 16), words);
+        w += 2 * popcount16(need);
+        i += 16;
+    }
+
+    _mm512_storeu_si512(x.data(), s);
+    return i;
+}
+#endif
+
+/* Декодирование rANS: векторный путь по полным группам, хвост — скалярно */
+static bool decodeRans(const uint8_t* p, size_t size, const array<uint32_t, 256>& norm, uint32_t lanes,
+                       uint8_t* result, uint64_t origSize) {
+    if (size < lanes * sizeof(uint32_t)) return false;
+
+    RansDecodeTable table;
+    buildRansDecodeTable(norm, table);
+
+    array<uint32_t, RANS_MAX_LANES> x{};
+    std::memcpy(x.data(), p, lanes * sizeof(uint32_t));
+    const uint8_t* w = p + lanes * sizeof(uint32_t);
+    const uint8_t* end = p + size;
+
+    size_t done = 0;
+#if defined(__AVX512F__)
+    if (lanes == 16) done = decodeRansAvx512(x, w, end, table, result, origSize);
+#endif
+#if defined(__AVX2__)
+    if (done == 0) done = decodeRansAvx2(x, lanes, w, end, table, result, origSize);
+#endif
+    decodeRansScalar(x, lanes, w, end, table, result, done, origSize);
+    return true;
+}
+
+/*
+ * Независимые куски: вход делится на куски по chunkSize байт, каждый кодируется
+ * своим состоянием кодера при общей для всех модели (таблица частот в заголовке).
+ * После полей движка — varint chunkSize, потом сжатые куски подряд, в конце
+ * файла — индекс: u32 сжатый размер каждого куска. Число кусков следует из
+ * origSize, поэтому индекс находится от конца файла. Куски кодируются волнами
+ * по pool.size() штук, так что память не растёт с размером входа, а границы кусков
+ * не зависят от числа потоков — и результат тоже.
+ */
+template <class Fn>
+static void encodeChunks(const uint8_t* src, size_t n, uint64_t chunkSize, WorkerPool& pool,
+                         OutputSink& sink, Fn encodeChunk) {
+    const unsigned threads = pool.size();
+    putVarint(sink.buf(), chunkSize);
+
+    const size_t count = static_cast<size_t>((n + chunkSize - 1) / chunkSize);
+    std::vector<uint32_t> sizes;
+    sizes.reserve(count);
+    std::vector<std::vector<uint8_t>> wave(threads);
+
+    for (size_t first = 0; first < count; first += threads) {
+        const size_t m = std::min<size_t>(threads, count - first);
+        pool.run(m, [&](size_t k) {
+            const size_t from = static_cast<size_t>((first + k) * chunkSize);
+            const size_t len = static_cast<size_t>(std::min<uint64_t>(chunkSize, n - from));
+            wave[k].clear();
+            encodeChunk(src + from, len, wave[k]);
+        });
+        for (size_t k = 0; k < m; k++) {
+            sizes.push_back(static_cast<uint32_t>(wave[k].size()));
+            sink.buf().insert(sink.buf().end(), wave[k].begin(), wave[k].end());
+            sink.drainIfFull();
+        }
+    }
+
+    std::vector<uint8_t>& out = sink.buf();
+    for (uint32_t sz : sizes) {
+        out.resize(out.size() + sizeof(sz));
+        std::memcpy(out.data() + out.size() - sizeof(sz), &sz, sizeof(sz));
+    }
+}
+
+/*
+ * Разбор кусков при декодировании: индекс в конце payload, каждый кусок
+ * декодируется в свой участок результата. Куски идут волнами по CHUNK_WAVE,
+ * смещения волны лежат на стеке. false — индекс не сходится с данными.
+ */
+constexpr size_t CHUNK_WAVE = 64;
+
+template <class Fn>
+static bool decodeChunks(const uint8_t* p, size_t payload, uint8_t* result, uint64_t origSize,
+                         uint64_t chunkSize, WorkerPool& pool, Fn decodeChunk) {
+    const uint64_t count = (origSize + chunkSize - 1) / chunkSize;
+    if (count > payload / sizeof(uint32_t)) return false;
+    const size_t indexPos = payload - static_cast<size_t>(count) * sizeof(uint32_t);
+
+    array<size_t, CHUNK_WAVE + 1> offsets{};
+    size_t pos = 0;
+    for (size_t first = 0; first < count; first += CHUNK_WAVE) {
+        const size_t m = std::min<size_t>(CHUNK_WAVE, static_cast<size_t>(count) - first);
+        offsets[0] = pos;
+        for (size_t k = 0; k < m; k++) {
+            uint32_t sz;
+            std::memcpy(&sz, p + indexPos + (first + k) * sizeof(sz), sizeof(sz));
+            offsets[k + 1] = offsets[k] + sz;
+            if (offsets[k + 1] > indexPos) return false;
+        }
+        pos = offsets[m];
+
+        pool.run(m, [&](size_t k) {
+            const uint64_t from = (first + k) * chunkSize;
+            const size_t len = static_cast<size_t>(std::min(chunkSize, origSize - from));
+            decodeChunk(p + offsets[k], offsets[k + 1] - offsets[k], result + from, len);
+        });
+    }
+    return true;
+}
+
+/*
+ * Побитовое кодирование: нормализация по одному биту, underflow через pending.
+ * Частоты нормируются к 2^BIT_TOTAL_BITS, поэтому сужение интервала обходится
+ * сдвигами. drain() зовётся раз в 64K символов, чтобы сбросить выход.
+ */
+template <class Out, class Drain>
+static void encodeBitSymbols(const uint8_t* src, size_t n, const array<uint32_t, 257>& cum,
+                             Out& packed, Drain drain) {
+    const ShiftScale scale{1u << BIT_TOTAL_BITS, BIT_TOTAL_BITS};
+
+    uint64_t low = 0;
+    uint64_t high = BitState::MAX_VALUE;
+    uint32_t pending = 0;
+
+    BitWriter bw(packed);
+
+    /* Функция вывода “стабильного” бита + обработка pending (underflow) */
+    auto outputBit = [&](bool bit) {
+        bw.writeBit(bit);
+        while (pending > 0) {
+            bw.writeBit(!bit);
+            pending--;
+        }
+    };
+
+    /* Основной цикл кодирования по символам */
+    for (size_t i = 0; i < n; i++) {
+        if ((i & 0xFFFF) == 0) drain();
+        uint32_t s = src[i];
+
+        /* Сужение интервала под символ s */
+        BitState::narrow(low, high, cum[s], cum[s + 1], scale);
+
+        /* Нормализация интервала и выдача битов */
+        while (true) {
+            if (high < BitState::HALF) {
+                outputBit(false);
+            } else if (low >= BitState::HALF) {
+                outputBit(true);
+                low -= BitState::HALF;
+                high -= BitState::HALF;
+            } else if (low >= BitState::QUARTER && high < BitState::THREE_QUARTERS) {
+                pending++;
+                low -= BitState::QUARTER;
+                high -= BitState::QUARTER;
+            } else {
+                break;
+            }
+
+            low <<= 1;
+            high = (high << 1) | 1;
+        }
+    }
+
+    /* Финализация: вывод завершающих битов */
+    pending++;
+    if (low < BitState::QUARTER) outputBit(false);
+    else outputBit(true);
+
+    /* Закрываем битовый поток */
+    bw.flushFinal();
+}
+
+/*
+ * Побитовый кодер целиком. Заголовок: контейнер, разреженная таблица частот.
+ * Длину потока не храним: за концом файла декодер читает нули, как и добивку
+ * последнего байта. chunkSize != 0 — независимые куски (encodeChunks).
+ */
+template <class Out>
+static void putBitLevelHeader(Out& out, const array<uint64_t, 256>& freq, uint64_t n, bool chunked,
+                              array<uint32_t, 257>& cum) {
+    array<uint32_t, 256> norm{};
+    normalizeFreq(freq, BIT_TOTAL_BITS, norm);
+
+    uint32_t total = 0;
+    buildCum(norm, cum, total);
+
+    /* Заголовок: контейнер, частоты */
+    putHeader(out, MAGIC_BIT_NORM, n, chunked);
+    putFreqTable(out, norm);
+}
+
+static void encodeBitLevel(const uint8_t* src, size_t n, const array<uint64_t, 256>& freq,
+                           uint64_t chunkSize, WorkerPool& pool, OutputSink& sink) {
+    array<uint32_t, 257> cum{};
+    putBitLevelHeader(sink.buf(), freq, n, chunkSize != 0, cum);
+
+    if (chunkSize == 0) {
+        encodeBitSymbols(src, n, cum, sink.buf(), [&] { sink.drainIfFull(); });
+        return;
+    }
+    encodeChunks(src, n, chunkSize, pool, sink, [&](const uint8_t* p, size_t len, std::vector<uint8_t>& out) {
+        encodeBitSymbols(p, len, cum, out, [] {});
+    });
+}
+
+/* Цикл range-кодирования одного потока */
+template <class Out, class Drain>
+static void encodeRangeSymbols(const uint8_t* src, size_t n, const array<uint32_t, 257>& cum,
+                               Out& packed, Drain drain) {
+    RangeEncoder<Out> rc(packed);
+    for (size_t i = 0; i < n; i++) {
+        if ((i & 0xFFFF) == 0) drain();
+        uint32_t s = src[i];
+        rc.encode(cum[s], cum[s + 1] - cum[s], RANGE_TOTAL_BITS);
+    }
+    rc.flush();
+}
+
+/* Байтовое range-кодирование; заголовок: контейнер, нормированные частоты (u16) */
+template <class Out>
+static void putRangeHeader(Out& out, const array<uint64_t, 256>& freq, uint64_t n, bool chunked,
+                           array<uint32_t, 257>& cum) {
+    array<uint32_t, 256> norm{};
+    normalizeFreq(freq, RANGE_TOTAL_BITS, norm);
+
+    uint32_t total = 0;
+    buildCum(norm, cum, total);
+
+    putHeader(out, MAGIC_RANGE, n, chunked);
+    putFreq16(out, norm);
+}
+
+static void encodeRange(const uint8_t* src, size_t n, const array<uint64_t, 256>& freq,
+                        uint64_t chunkSize, WorkerPool& pool, OutputSink& sink) {
+    array<uint32_t, 257> cum{};
+    putRangeHeader(sink.buf(), freq, n, chunkSize != 0, cum);
+
+    if (chunkSize == 0) {
+        encodeRangeSymbols(src, n, cum, sink.buf(), [&] { sink.drainIfFull(); });
+        return;
+    }
+    encodeChunks(src, n, chunkSize, pool, sink, [&](const uint8_t* p, size_t len, std::vector<uint8_t>& out) {
+        encodeRangeSymbols(p, len, cum, out, [] {});
+    });
+}
+
+/*
+ * tANS: контейнер, нормированные к 2^12 частоты (u16), поток битов.
+ * Символы кодируются с конца, в хвосте потока — финальное состояние;
+ * поэтому весь поток собирается в памяти и сбрасывается только в конце.
+ */
+static void encodeTans(const uint8_t* src, size_t n, const array<uint64_t, 256>& freq,
+                       OutputSink& sink) {
+    std::vector<uint8_t>& packed = sink.buf();
+    array<uint32_t, 256> norm{};
+    normalizeFreq(freq, TANS_TABLE_LOG, norm);
+
+    putHeader(packed, MAGIC_TANS, n);
+    putFreq16(packed, norm);
+
+    const TansEncoderTable table(norm);
+    LsbBitWriter bw(packed);
+
+    uint32_t state = 1u << TANS_TABLE_LOG;
+    for (size_t i = n; i-- > 0;) {
+        const TansSymbol& sym = table.symbols[src[i]];
+        uint32_t nbBits = (state + sym.deltaNbBits) >> 16;
+        bw.writeBits(state & ((1u << nbBits) - 1), nbBits);
+        state = table.stateTable[(state >> nbBits) + sym.deltaFindState];
+    }
+
+    /* Декодер начинает с этого состояния: храним его без старшего бита */
+    bw.writeBits(state - (1u << TANS_TABLE_LOG), TANS_TABLE_LOG);
+    bw.finish();
+}
+
+/* Декодирование tANS: на символ одно обращение к таблице и одно чтение бит */
+static bool decodeTans(const uint8_t* p, size_t size, const array<uint32_t, 256>& norm,
+                       uint8_t* result, uint64_t origSize) {
+    TansDecodeTable table;
+    buildTansDecodeTable(norm, table);
+
+    BackwardBitReader br(p, size);
+    if (!br.valid()) return false;
+
+    uint32_t state = br.readBits(TANS_TABLE_LOG);
+    for (uint64_t produced = 0; produced < origSize; produced++) {
+        const TansDecodeEntry& e = table[state];
+        result[produced] = e.symbol;
+        state = e.newStateBase + br.readBits(e.nbBits);
+    }
+    return true;
+}
+
+/*
+ * rANS: контейнер, нормированные к 2^12 частоты (u16), число дорожек (u8),
+ * начальные состояния декодера (u32 на дорожку), 16-битные слова и N нулевых
+ * слов запаса, чтобы векторный декодер мог читать блоками до самого конца.
+ */
+static void encodeRans(const uint8_t* src, size_t n, const array<uint64_t, 256>& freq, uint32_t lanes,
+                       OutputSink& sink) {
+    std::vector<uint8_t>& packed = sink.buf();
+    array<uint32_t, 256> norm{};
+    normalizeFreq(freq, RANS_PROB_BITS, norm);
+
+    array<uint32_t, 257> cum{};
+    uint32_t total = 0;
+    buildCum(norm, cum, total);
+
+    putHeader(packed, MAGIC_RANS, n);
+    putFreq16(packed, norm);
+    packed.push_back(static_cast<uint8_t>(lanes));
+
+    /* Кодируем с конца: слова выходят в обратном порядке чтения */
+    array<uint32_t, RANS_MAX_LANES> x{};
+    x.fill(RANS_L);
+    std::vector<uint16_t> words;
+    words.reserve(n / 2 + 16);
+
+    for (size_t i = n; i-- > 0;) {
+        uint32_t& st = x[i % lanes];
+        uint32_t s = src[i];
+        uint32_t f = norm[s];
+        const uint64_t xMax = static_cast<uint64_t>(f) << (32 - RANS_PROB_BITS);
+        if (st >= xMax) {
+            words.push_back(static_cast<uint16_t>(st));
+            st >>= 16;
+        }
+        st = ((st / f) << RANS_PROB_BITS) + (st % f) + cum[s];
+    }
+
+    size_t pos = packed.size();
+    packed.resize(pos + lanes * sizeof(uint32_t) + (words.size() + lanes) * 2);
+    std::memcpy(packed.data() + pos, x.data(), lanes * sizeof(uint32_t));
+    pos += lanes * sizeof(uint32_t);
+    for (size_t k = words.size(); k-- > 0;) {
+        packed[pos++] = static_cast<uint8_t>(words[k]);
+        packed[pos++] = static_cast<uint8_t>(words[k] >> 8);
+    }
+    std::memset(packed.data() + pos, 0, lanes * 2);
+}
+
+/*
+ * Кодирование входа адаптивной моделью: вход читается кусками по ADAPT_CHUNK
+ * байт, второго прохода нет, поэтому годится и канал. Выход идёт только
+ * вперёд: перед каждым куском в том же потоке кодируется его длина
+ * (STREAM_LEN_BITS равновероятных бит), нулевая длина — конец. Размер входа
+ * заранее не нужен, поэтому выход можно писать в канал или сокет, а декодер
+ * может начать работу до того, как кодер закончит. Возвращает число байт входа.
+ */
+constexpr size_t ADAPT_CHUNK = size_t(1) << 16;
+constexpr uint32_t STREAM_LEN_BITS = 17;
+
+template <class Encoder, class Model>
+static uint64_t encodeStream(std::istream& in, Model& model, OutputSink& sink) {
+    Encoder rc(sink.buf());
+    std::vector<char> buf(ADAPT_CHUNK);
+    uint64_t n = 0;
+    while (in) {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        size_t got = static_cast<size_t>(in.gcount());
+        if (got == 0) break;
+        rc.encodeRaw(static_cast<uint32_t>(got), STREAM_LEN_BITS);
+        for (size_t i = 0; i < got; i++) model.encode(rc, static_cast<uint8_t>(buf[i]));
+        n += got;
+        sink.drainIfFull();
+    }
+    rc.encodeRaw(0, STREAM_LEN_BITS);
+    rc.flush();
+    return n;
+}
+
+/* Декодирование потока по кускам до нулевой длины; false — повреждённая длина */
+template <class Decoder, class Model>
+static bool decodeStream(Decoder& rd, Model& model, OutputSink& sink, uint64_t& produced) {
+    produced = 0;
+    for (;;) {
+        const uint32_t len = rd.decodeRaw(STREAM_LEN_BITS);
+        if (len == 0) return true;
+        if (len > ADAPT_CHUNK) return false;
+        std::vector<uint8_t>& out = sink.buf();
+        for (uint32_t i = 0; i < len; i++) out.push_back(static_cast<uint8_t>(model.decode(rd)));
+        produced += len;
+        sink.drainIfFull();
+    }
+}
+
+/* Декодирование адаптивного потока старого формата: ровно origSize байт */
+template <class Decoder, class Model>
+static void decodeSized(const uint8_t* p, size_t size, Model& model, uint8_t* result, uint64_t origSize) {
+    Decoder rd(p, size);
+    for (uint64_t produced = 0; produced < origSize; produced++) {
+        result[produced] = static_cast<uint8_t>(model.decode(rd));
+    }
+}
+
+/* Адаптивный порядок 0: контейнер и сразу поток, таблицы частот нет */
+static uint64_t encodeAdaptive(std::istream& in, OutputSink& sink) {
+    putHeader(sink.buf(), MAGIC_ADAPTIVE, SIZE_STREAMED);
+
+    AdaptiveModel model;
+    return encodeStream<RangeEncoder<>>(in, model, sink);
+}
+
+/* PPM: контейнер, порядок (u8), бюджет памяти модели в МБ (u32), поток */
+static uint64_t encodePpm(std::istream& in, uint32_t order, uint32_t memMb, OutputSink& sink,
+                          size_t& modelBytes) {
+    std::vector<uint8_t>& packed = sink.buf();
+    putHeader(packed, MAGIC_PPM, SIZE_STREAMED);
+    packed.push_back(static_cast<uint8_t>(order));
+    packed.resize(packed.size() + sizeof(memMb));
+    std::memcpy(packed.data() + packed.size() - sizeof(memMb), &memMb, sizeof(memMb));
+
+    PpmModel model(order, size_t(memMb) << 20);
+    modelBytes = model.memoryBytes();
+    return encodeStream<RangeEncoder<>>(in, model, sink);
+}
+
+/* CM: контейнер, бюджет памяти моделей в МБ (u32), поток двоичного кодера */
+static uint64_t encodeCm(std::istream& in, uint32_t memMb, OutputSink& sink, size_t& modelBytes) {
+    std::vector<uint8_t>& packed = sink.buf();
+    putHeader(packed, MAGIC_CM, SIZE_STREAMED);
+    packed.resize(packed.size() + sizeof(memMb));
+    std::memcpy(packed.data() + packed.size() - sizeof(memMb), &memMb, sizeof(memMb));
+
+    CmModel model(size_t(memMb) << 20);
+    modelBytes = model.memoryBytes();
+    return encodeStream<BinaryEncoder>(in, model, sink);
+}
+
+/* Заголовок сжатого файла любого из движков */
+struct ArithHeader {
+    uint32_t magic{0};                  // magic движка (для контейнера — восстановленный по коду)
+    uint64_t origSize{0};
+    array<uint32_t, 256> freq{};
+    uint64_t encodedBitCount{0};        // только для побитового кодера старого формата
+    uint32_t totalBits{0};              // log2 суммы нормированных частот; 0 — без нормировки
+    uint32_t lanes{0};                  // только для rANS
+    uint32_t order{0};                  // только для PPM
+    uint32_t memMb{0};                  // только для PPM и CM
+    uint64_t chunkSize{0};              // независимые куски побитового и range-кодера; 0 — один поток
+    bool framed{false};                 // кадры потокового интерфейса (адаптивные движки)
+    size_t size{0};                     // байт заголовка
+};
+
+/*
+ * Разбор заголовка по magic; false — неизвестный формат или усечённый файл.
+ * Контейнер второй редакции сводится к прежнему magic движка, отличается
+ * только смещение полей движка (base).
+ */
+static bool readHeader(const uint8_t* p, size_t size, ArithHeader& h) {
+    if (size < 8) return false;
+    std::memcpy(&h.magic, p, sizeof(h.magic));
+
+    size_t base = 8;
+    if (h.magic == MAGIC_CONTAINER) {
+        if (size < CONTAINER_HEADER) return false;
+        h.magic = (MAGIC_BIT & 0xFFFFFF00u) | (p[4] & ~ENGINE_CHUNKED);
+        std::memcpy(&h.origSize, p + CONTAINER_SIZE_POS, sizeof(h.origSize));
+        if (p[4] & ENGINE_CHUNKED) {
+            /* У побитового и range-кодера — куски, chunkSize после их таблицы; у адаптивных — кадры */
+            if (h.magic == MAGIC_BIT_NORM || h.magic == MAGIC_RANGE) h.chunkSize = 1;
+            else if (h.magic == MAGIC_ADAPTIVE || h.magic == MAGIC_PPM || h.magic == MAGIC_CM) h.framed = true;
+            else return false;
+            if (h.framed && h.origSize != SIZE_STREAMED) return false;
+        }
+        base = CONTAINER_HEADER;
+    } else {
+        uint32_t size32 = 0;
+        std::memcpy(&size32, p + 4, sizeof(size32));
+        h.origSize = size32;
+    }
+    const uint8_t* q = p + base;
+
+    if (h.magic == MAGIC_BIT) {
+        h.size = base + sizeof(uint32_t) * 256 + sizeof(h.encodedBitCount);
+        if (size < h.size) return false;
+        std::memcpy(h.freq.data(), q, sizeof(uint32_t) * 256);
+        std::memcpy(&h.encodedBitCount, q + sizeof(uint32_t) * 256, sizeof(h.encodedBitCount));
+
+        /* Сырые частоты: сумма в 64 битах, 32-битному кодеру нужна не больше четверти интервала */
+        uint64_t total = 0;
+        for (uint32_t f : h.freq) total += f;
+        return total != 0 && total <= BitState::QUARTER;
+    }
+    if (h.magic == MAGIC_STORED) {
+        h.size = base;
+        return base == CONTAINER_HEADER && h.chunkSize == 0;
+    }
+    if (h.magic == MAGIC_BIT_NORM) {
+        h.totalBits = BIT_TOTAL_BITS;
+        if (!readFreqTable(q, p + size, h.freq)) return false;
+        if (h.chunkSize != 0 && (!readVarint(q, p + size, h.chunkSize) || h.chunkSize == 0)) return false;
+        h.size = static_cast<size_t>(q - p);
+        return true;
+    }
+    if (h.magic == MAGIC_RANGE || h.magic == MAGIC_TANS || h.magic == MAGIC_RANS) {
+        h.totalBits = h.magic == MAGIC_RANGE ? RANGE_TOTAL_BITS : h.magic == MAGIC_TANS ? TANS_TABLE_LOG : RANS_PROB_BITS;
+        h.size = base + sizeof(uint16_t) * 256 + (h.magic == MAGIC_RANS ? 1 : 0);
+        if (size < h.size) return false;
+        for (int i = 0; i < 256; i++) {
+            uint16_t f = 0;
+            std::memcpy(&f, q + i * sizeof(f), sizeof(f));
+            h.freq[i] = f;
+        }
+        if (h.magic == MAGIC_RANGE && h.chunkSize != 0) {
+            const uint8_t* c = p + h.size;
+            if (!readVarint(c, p + size, h.chunkSize) || h.chunkSize == 0) return false;
+            h.size = static_cast<size_t>(c - p);
+        }
+        if (h.magic != MAGIC_RANS) return true;
+        h.lanes = p[h.size - 1];
+        return h.lanes == 8 || h.lanes == 16;
+    }
+    if (h.magic == MAGIC_ADAPTIVE) {
+        h.size = base;
+        return true;
+    }
+    if (h.magic == MAGIC_PPM) {
+        h.size = base + 1 + sizeof(h.memMb);
+        if (size < h.size) return false;
+        h.order = q[0];
+        std::memcpy(&h.memMb, q + 1, sizeof(h.memMb));
+        return h.order >= 1 && h.order <= PPM_MAX_ORDER && h.memMb >= 1 && h.memMb <= 4096;
+    }
+    if (h.magic == MAGIC_CM) {
+        h.size = base + sizeof(h.memMb);
+        if (size < h.size) return false;
+        std::memcpy(&h.memMb, q, sizeof(h.memMb));
+        return h.memMb >= 1 && h.memMb <= 4096;
+    }
+    return false;
+}
+
+/* Декодирование самозавершающегося потока адаптивной модели выбранного в заголовке движка */
+static bool decodeStreamed(ByteInput input, const ArithHeader& h, OutputSink& sink, uint64_t& produced) {
+    if (h.magic == MAGIC_CM) {
+        CmModel model(size_t(h.memMb) << 20);
+        BinaryDecoder bd(std::move(input));
+        return decodeStream(bd, model, sink, produced);
+    }
+    RangeDecoder rd(std::move(input));
+    if (h.magic == MAGIC_PPM) {
+        PpmModel model(h.order, size_t(h.memMb) << 20);
+        return decodeStream(rd, model, sink, produced);
+    }
+    AdaptiveModel model;
+    return decodeStream(rd, model, sink, produced);
+}
+
+/* Заголовок самозавершающегося потока целиком помещается в столько байт */
+constexpr size_t STREAM_HEAD_MAX = 32;
+
+/*
+ * Библиотечный интерфейс: сжатие и распаковка из буфера в буфер, без файлов
+ * и потоков ввода-вывода; буфер результата выделяет вызывающий.
+ * compress кодирует статическими движками (побитовым или range, opt.engine)
+ * одним потоком, без кусков; если данные не сжимаются, они хранятся как есть,
+ * поэтому результат никогда не длиннее compressBound(n). decompress понимает
+ * все форматы с известным размером, в том числе прежние; самозавершающиеся
+ * потоки адаптивных движков распаковываются только потоковым путём.
+ * Память в куче не выделяется при opt.threads == 1: в compress — всегда,
+ * в decompress — для побитового и range-кодера (в том числе кусками), tANS,
+ * rANS и несжатых данных; модели PPM и CM выделяются всегда. При другом
+ * opt.threads пул создаёт потоки, как только работы хватает на несколько:
+ * частоты входа от 8 МБ в compress, несколько кусков в decompress.
+ */
+constexpr size_t ARITH_HEADER_MAX = CONTAINER_HEADER + 2 + 256 * 5;   // контейнер + худшая таблица частот
+
+size_t compressBound(size_t n) {
+    return CONTAINER_HEADER + n;
+}
+
+/* Сжатие n байт в dst; false — не хватило capacity или движок не поддерживается */
+bool compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity,
+              const ArithOptions& opt, size_t& written) {
+    if ((opt.engine != ArithEngine::Bit && opt.engine != ArithEngine::Range) || opt.chunkMb != 0) return false;
+
+    /* 1) Частоты и заголовок — в буфер на стеке */
+    array<uint64_t, 256> counts{};
+    WorkerPool pool(resolveThreads(opt.threads));
+    countHistogram(src, n, pool, counts);
+
+    array<uint8_t, ARITH_HEADER_MAX> head;
+    FixedOutput header(head.data(), head.size());
+    array<uint32_t, 257> cum{};
+    if (opt.engine == ArithEngine::Range) putRangeHeader(header, counts, n, false, cum);
+    else putBitLevelHeader(header, counts, n, false, cum);
+
+    /* 2) Кодируем сразу за заголовком; длиннее несжатых данных — незачем */
+    const size_t limit = std::min(capacity, compressBound(n));
+    if (header.size() < limit) {
+        FixedOutput payload(dst + header.size(), limit - header.size());
+        if (opt.engine == ArithEngine::Range) encodeRangeSymbols(src, n, cum, payload, [] {});
+        else encodeBitSymbols(src, n, cum, payload, [] {});
+
+        if (!payload.overflow()) {
+            std::memcpy(dst, head.data(), header.size());
+            written = header.size() + payload.size();
+            return true;
+        }
+    }
+
+    /* 3) Не сжимается: храним как есть */
+    if (capacity < compressBound(n)) return false;
+    FixedOutput stored(dst, capacity);
+    putHeader(stored, MAGIC_STORED, n);
+    if (n != 0) std::memcpy(dst + CONTAINER_HEADER, src, n);
+    written = CONTAINER_HEADER + n;
+    return true;
+}
+
+/* Размер распакованных данных по заголовку; false — не наш формат или размер неизвестен */
+bool decompressedSize(const uint8_t* src, size_t size, uint64_t& origSize) {
+    ArithHeader h;
+    if (!readHeader(src, size, h) || h.origSize == SIZE_STREAMED) return false;
+    origSize = h.origSize;
+    return true;
+}
+
+/* Распаковка в dst; false — данные повреждены или не хватило capacity */
+bool decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity,
+                const ArithOptions& opt, size_t& written) {
+    ArithHeader h;
+    if (!readHeader(src, size, h) || h.origSize == SIZE_STREAMED || h.origSize > capacity) return false;
+
+    /* 1) Несжатые данные просто копируются */
+    if (h.magic == MAGIC_STORED) {
+        if (size - h.size < h.origSize) return false;
+        if (h.origSize != 0) std::memcpy(dst, src + h.size, static_cast<size_t>(h.origSize));
+        written = static_cast<size_t>(h.origSize);
+        return true;
+    }
+
+    /* 2) Восстанавливаем cum и total */
+    array<uint32_t, 257> cum{};
+    uint32_t total = 0;
+    buildCum(h.freq, cum, total);
+    const bool adaptive = h.magic == MAGIC_ADAPTIVE || h.magic == MAGIC_PPM || h.magic == MAGIC_CM;
+    if (!adaptive && (total == 0 || (h.totalBits != 0 && total != (1u << h.totalBits)))) return false;
+
+    /* 3) Декодирование; range и побитовый кодер — с выбранным поиском символа */
+    const uint8_t* p = src + h.size;
+    size_t payload = size - h.size;
+
+    if (h.magic == MAGIC_ADAPTIVE) {
+        AdaptiveModel model;
+        decodeSized<RangeDecoder>(p, payload, model, dst, h.origSize);
+    } else if (h.magic == MAGIC_PPM) {
+        PpmModel model(h.order, size_t(h.memMb) << 20);
+        decodeSized<RangeDecoder>(p, payload, model, dst, h.origSize);
+    } else if (h.magic == MAGIC_CM) {
+        CmModel model(size_t(h.memMb) << 20);
+        decodeSized<BinaryDecoder>(p, payload, model, dst, h.origSize);
+    } else if (h.magic == MAGIC_RANS) {
+        if (!decodeRans(p, payload, h.freq, h.lanes, dst, h.origSize)) return false;
+    } else if (h.magic == MAGIC_TANS) {
+        if (!decodeTans(p, payload, h.freq, dst, h.origSize)) return false;
+    } else if (h.chunkSize != 0) {
+        /* Независимые куски: свой декодер на кусок, таблица поиска общая */
+        bool ok = false;
+        WorkerPool pool(resolveThreads(opt.threads));
+        withFinder(opt.search, cum, total, [&](const auto& find) {
+            ok = decodeChunks(p, payload, dst, h.origSize, h.chunkSize, pool,
+                              [&](const uint8_t* chunk, size_t chunkBytes, uint8_t* to, size_t len) {
+                if (h.magic == MAGIC_RANGE) {
+                    RangeDecoder rd(chunk, chunkBytes);
+                    decodeRangeSymbols(rd, cum, to, len, find);
+                    return;
+                }
+                BitReader br(chunk, chunkBytes);
+                decodeSymbols(br, cum, ShiftScale{total, h.totalBits}, to, len, find);
+            });
+        });
+        if (!ok) return false;
+    } else if (h.magic == MAGIC_RANGE) {
+        RangeDecoder rd(p, payload);
+        withFinder(opt.search, cum, total, [&](const auto& find) {
+            decodeRangeSymbols(rd, cum, dst, h.origSize, find);
+        });
+    } else if (h.magic == MAGIC_BIT_NORM) {
+        BitReader br(p, payload);
+        withFinder(opt.search, cum, total, [&](const auto& find) {
+            decodeSymbols(br, cum, ShiftScale{total, h.totalBits}, dst, h.origSize, find);
+        });
+    } else {
+        /* Биты за encodedBitCount читаются как нули: ограничиваем поток его байтами */
+        if ((h.encodedBitCount + 7) / 8 < payload) payload = static_cast<size_t>((h.encodedBitCount + 7) / 8);
+        BitReader br(p, payload);
+        withFinder(opt.search, cum, total, [&](const auto& find) {
+            decodeSymbols(br, cum, DivScale{total}, dst, h.origSize, find);
+        });
+    }
+
+    written = static_cast<size_t>(h.origSize);
+    return true;
+}
+
+/*
+ * Потоковый интерфейс в духе z_stream: вызывающий подаёт вход кусками любого
+ * размера и забирает выход в буферы фиксированного размера, указатели и
+ * счётчики в StreamIo двигает сам вызов. Работают адаптивные движки
+ * (adaptive, PPM, CM) — статическим нужен весь вход заранее.
+ *
+ * Поток делится на кадры: varint длина исходных данных (до STREAM_FRAME),
+ * varint длина закодированных, сами данные; нулевая длина — конец. Каждый
+ * кадр кодируется своим кодером, а модель переходит из кадра в кадр, так что
+ * сжатие почти не страдает (5 байт на кадр), а декодер берёт кадр целиком и
+ * никогда не ждёт байтов, которых кодер ещё не выдал. Flush закрывает
+ * текущий кадр досрочно: всё поданное до него распаковывается без остального
+ * потока. В памяти — не больше одного кадра входа и выхода.
+ */
+enum class StreamFlush { None, Flush, Finish };
+enum class StreamStatus { Ok, End, Error };
+
+struct StreamIo {
+    const uint8_t* nextIn{nullptr};
+    size_t availIn{0};
+    uint8_t* nextOut{nullptr};
+    size_t availOut{0};
+};
+
+constexpr size_t STREAM_FRAME = ADAPT_CHUNK;
+constexpr uint64_t STREAM_FRAME_CODED_MAX = uint64_t(STREAM_FRAME) * 16;   // больше — порча
+
+/* Модель адаптивного движка вместе с её кодером: кадр целиком в одну сторону */
+class FrameCodec {
+public:
+    virtual ~FrameCodec() = default;
+    virtual void encode(const uint8_t* src, size_t n, std::vector<uint8_t>& out) = 0;
+    virtual void decode(const uint8_t* p, size_t size, uint8_t* dst, size_t n) = 0;
+};
+
+template <class Encoder, class Decoder, class Model>
+class ModelFrameCodec : public FrameCodec {
+public:
+    template <class... Args>
+    explicit ModelFrameCodec(Args... args) : model_(args...) {}
+
+    void encode(const uint8_t* src, size_t n, std::vector<uint8_t>& out) override {
+        Encoder rc(out);
+        for (size_t i = 0; i < n; i++) model_.encode(rc, src[i]);
+        rc.flush();
+    }
+
+    void decode(const uint8_t* p, size_t size, uint8_t* dst, size_t n) override {
+        Decoder rd(p, size);
+        for (size_t i = 0; i < n; i++) dst[i] = static_cast<uint8_t>(model_.decode(rd));
+    }
+
+private:
+    Model model_;
+};
+
+/* Модель по заголовку; nullptr — движок не адаптивный */
+static std::unique_ptr<FrameCodec> makeFrameCodec(uint32_t magic, uint32_t order, uint32_t memMb) {
+    if (magic == MAGIC_ADAPTIVE) return std::make_unique<ModelFrameCodec<RangeEncoder<>, RangeDecoder, AdaptiveModel>>();
+    if (magic == MAGIC_PPM) {
+        return std::make_unique<ModelFrameCodec<RangeEncoder<>, RangeDecoder, PpmModel>>(order, size_t(memMb) << 20);
+    }
+    if (magic == MAGIC_CM) return std::make_unique<ModelFrameCodec<BinaryEncoder, BinaryDecoder, CmModel>>(size_t(memMb) << 20);
+    return nullptr;
+}
+
+/* Отдаём накопленный выход; true — отдан целиком */
+static bool drainStream(std::vector<uint8_t>& out, size_t& outPos, StreamIo& io) {
+    const size_t take = std::min(out.size() - outPos, io.availOut);
+    if (take > 0) std::memcpy(io.nextOut, out.data() + outPos, take);
+    io.nextOut += take;
+    io.availOut -= take;
+    outPos += take;
+    if (outPos < out.size()) return false;
+    out.clear();
+    outPos = 0;
+    return true;
+}
+
+class CompressStream {
+public:
+    /* Заголовок контейнера с флагом кадров; false — движок не адаптивный */
+    bool init(const ArithOptions& opt) {
+        out_.clear();
+        outPos_ = 0;
+        pending_.clear();
+        finished_ = false;
+
+        if (opt.engine == ArithEngine::Adaptive) {
+            putHeader(out_, MAGIC_ADAPTIVE, SIZE_STREAMED, true);
+            codec_ = makeFrameCodec(MAGIC_ADAPTIVE, 0, 0);
+        } else if (opt.engine == ArithEngine::Ppm) {
+            const uint32_t memMb = opt.memMb ? opt.memMb : PPM_DEFAULT_MB;
+            if (opt.order < 1 || opt.order > PPM_MAX_ORDER || memMb > 4096) return false;
+            putHeader(out_, MAGIC_PPM, SIZE_STREAMED, true);
+            out_.push_back(static_cast<uint8_t>(opt.order));
+            out_.resize(out_.size() + sizeof(memMb));
+            std::memcpy(out_.data() + out_.size() - sizeof(memMb), &memMb, sizeof(memMb));
+            codec_ = makeFrameCodec(MAGIC_PPM, opt.order, memMb);
+        } else if (opt.engine == ArithEngine::Cm) {
+            const uint32_t memMb = opt.memMb ? opt.memMb : CM_DEFAULT_MB;
+            if (memMb > 4096) return false;
+            putHeader(out_, MAGIC_CM, SIZE_STREAMED, true);
+            out_.resize(out_.size() + sizeof(memMb));
+            std::memcpy(out_.data() + out_.size() - sizeof(memMb), &memMb, sizeof(memMb));
+            codec_ = makeFrameCodec(MAGIC_CM, 0, memMb);
+        } else {
+            codec_.reset();
+        }
+        return codec_ != nullptr;
+    }
+
+    /*
+     * Забирает вход и отдаёт выход, пока есть и то, и другое. None — кадры
+     * закрываются по заполнению; Flush — ещё и по концу входа; Finish — конец
+     * потока: End, когда выход отдан целиком. Вызывать снова, пока availOut == 0.
+     */
+    StreamStatus compress(StreamIo& io, StreamFlush flush) {
+        if (!codec_) return StreamStatus::Error;
+
+        for (;;) {
+            if (!drainStream(out_, outPos_, io)) return StreamStatus::Ok;
+            if (finished_) return StreamStatus::End;
+
+            if (io.availIn > 0) {
+                const size_t take = std::min(io.availIn, STREAM_FRAME - pending_.size());
+                pending_.insert(pending_.end(), io.nextIn, io.nextIn + take);
+                io.nextIn += take;
+                io.availIn -= take;
+                if (pending_.size() == STREAM_FRAME) emitFrame();
+                continue;
+            }
+
+            /* Вход кончился: по Flush и Finish закрываем начатый кадр */
+            if (flush == StreamFlush::None) return StreamStatus::Ok;
+            if (!pending_.empty()) {
+                emitFrame();
+                continue;
+            }
+            if (flush == StreamFlush::Flush) return StreamStatus::Ok;
+            putVarint(out_, 0);
+            finished_ = true;
+        }
+    }
+
+private:
+    void emitFrame() {
+        frame_.clear();
+        codec_->encode(pending_.data(), pending_.size(), frame_);
+        putVarint(out_, pending_.size());
+        putVarint(out_, frame_.size());
+        out_.insert(out_.end(), frame_.begin(), frame_.end());
+        pending_.clear();
+    }
+
+    std::unique_ptr<FrameCodec> codec_;
+    std::vector<uint8_t> pending_;      // вход текущего кадра
+    std::vector<uint8_t> frame_;        // закодированный кадр
+    std::vector<uint8_t> out_;          // выход, ещё не отданный вызывающему
+    size_t outPos_{0};
+    bool finished_{false};
+};
+
+class DecompressStream {
+public:
+    void init() {
+        in_.clear();
+        out_.clear();
+        outPos_ = 0;
+        codec_.reset();
+        finished_ = false;
+    }
+
+    /*
+     * Забирает вход, пока не соберёт заголовок или кадр целиком, и отдаёт
+     * распакованное. End — конец потока и весь выход отдан; вход за концом
+     * остаётся в io. Error — не наш поток или порча.
+     */
+    StreamStatus decompress(StreamIo& io) {
+        for (;;) {
+            if (!drainStream(out_, outPos_, io)) return StreamStatus::Ok;
+            if (finished_) return StreamStatus::End;
+
+            size_t need = 0;
+            if (!step(need)) return StreamStatus::Error;
+            if (need == 0) continue;
+
+            /* Не хватает входа: берём ровно до need байт */
+            if (io.availIn == 0) return StreamStatus::Ok;
+            const size_t take = std::min(io.availIn, need - in_.size());
+            in_.insert(in_.end(), io.nextIn, io.nextIn + take);
+            io.nextIn += take;
+            io.availIn -= take;
+        }
+    }
+
+private:
+    /* Шаг разбора накопленного входа; need != 0 — сколько байт нужно в in_ для шага */
+    bool step(size_t& need) {
+        const uint8_t* p = in_.data();
+        const uint8_t* end = p + in_.size();
+
+        if (!codec_) {
+            ArithHeader h;
+            if (!readHeader(p, in_.size(), h)) {
+                if (in_.size() >= STREAM_HEAD_MAX) return false;
+                need = in_.size() + 1;
+                return true;
+            }
+            if (!h.framed) return false;
+            codec_ = makeFrameCodec(h.magic, h.order, h.memMb);
+            in_.erase(in_.begin(), in_.begin() + static_cast<std::ptrdiff_t>(h.size));
+            return true;
+        }
+
+        /* Кадр: длина исходных, длина закодированных, данные */
+        uint64_t n = 0, coded = 0;
+        if (!readVarint(p, end, n)) {
+            need = in_.size() + 1;
+            return in_.size() < 10;
+        }
+        if (n == 0) {
+            finished_ = true;
+            return true;
+        }
+        if (n > STREAM_FRAME) return false;
+        if (!readVarint(p, end, coded)) {
+            need = in_.size() + 1;
+            return static_cast<size_t>(end - in_.data()) < 20;
+        }
+        if (coded > STREAM_FRAME_CODED_MAX) return false;
+
+        const size_t head = static_cast<size_t>(p - in_.data());
+        if (static_cast<uint64_t>(end - p) < coded) {
+            need = head + static_cast<size_t>(coded);
+            return true;
+        }
+
+        out_.resize(static_cast<size_t>(n));
+        codec_->decode(p, static_cast<size_t>(coded), out_.data(), static_cast<size_t>(n));
+        in_.erase(in_.begin(), in_.begin() + static_cast<std::ptrdiff_t>(head + coded));
+        return true;
+    }
+
+    std::unique_ptr<FrameCodec> codec_;
+    std::vector<uint8_t> in_;           // накопленный вход: заголовок или один кадр
+    std::vector<uint8_t> out_;          // распакованный кадр, ещё не отданный
+    size_t outPos_{0};
+    bool finished_{false};
+};
+
+}  // namespace arith
+
+#ifndef ARITH_NO_MAIN
+using namespace arith;
+
+/* Прокачка потока через CompressStream буферами по STREAM_IO байт: вход и выход — каналы */
+constexpr size_t STREAM_IO = size_t(1) << 16;
+
+static bool encodeFramed(std::istream& in, const ArithOptions& opt, std::ostream& out, uint64_t& n, uint64_t& written) {
+    CompressStream zs;
+    if (!zs.init(opt)) return false;
+    std::vector<uint8_t> inBuf(STREAM_IO), outBuf(STREAM_IO);
+    n = 0;
+    written = 0;
+    StreamFlush flush = StreamFlush::None;
+    StreamIo io;
+    for (;;) {
+        if (io.availIn == 0 && flush == StreamFlush::None) {
+            in.read(reinterpret_cast<char*>(inBuf.data()), static_cast<std::streamsize>(inBuf.size()));
+            io.nextIn = inBuf.data();
+            io.availIn = static_cast<size_t>(in.gcount());
+            n += io.availIn;
+            if (in.bad()) return false;         // ошибка чтения — не конец входа: конечный кадр не пишем
+            if (!in) flush = StreamFlush::Finish;
+        }
+        io.nextOut = outBuf.data();
+        io.availOut = outBuf.size();
+        const StreamStatus st = zs.compress(io, flush);
+        const size_t got = outBuf.size() - io.availOut;
+        out.write(reinterpret_cast<const char*>(outBuf.data()), static_cast<std::streamsize>(got));
+        written += got;
+        if (st == StreamStatus::Error) return false;
+        if (st == StreamStatus::End) return static_cast<bool>(out);
+    }
+}
+
+/* Распаковка кадров через DecompressStream; head — байты, уже прочитанные ради заголовка */
+static bool decodeFramed(std::istream& in, const uint8_t* head, size_t headSize, std::ostream& out) {
+    DecompressStream zs;
+    zs.init();
+    std::vector<uint8_t> inBuf(STREAM_IO), outBuf(STREAM_IO);
+    StreamIo io;
+    io.nextIn = head;
+    io.availIn = headSize;
+    for (;;) {
+        if (io.availIn == 0) {
+            in.read(reinterpret_cast<char*>(inBuf.data()), static_cast<std::streamsize>(inBuf.size()));
+            io.nextIn = inBuf.data();
+            io.availIn = static_cast<size_t>(in.gcount());
+            if (io.availIn == 0) return false;     // поток оборван до конца
+        }
+        io.nextOut = outBuf.data();
+        io.availOut = outBuf.size();
+        const StreamStatus st = zs.decompress(io);
+        out.write(reinterpret_cast<const char*>(outBuf.data()), static_cast<std::streamsize>(outBuf.size() - io.availOut));
+        if (st == StreamStatus::Error) return false;
+        if (st == StreamStatus::End) return static_cast<bool>(out);
+    }
+}
+
+/* Вход и выход — один файл (в том числе под другим путём): выход затёр бы вход */
+static bool samePath(const string& a, const string& b) {
+    std::error_code ec;
+    return std::filesystem::equivalent(a, b, ec);
+}
+
+/* Сжатие (арифметическое кодирование) */
+static bool compressArithmetic(const string& inPath, const string& outPath, const ArithOptions& opt) {
+    using clock = std::chrono::high_resolution_clock;
+    auto t0 = clock::now();
+
+    if (samePath(inPath, outPath)) {
+        cerr << "Input and output must be different files.\n";
+        return false;
+    }
+
+    /* Выход пишется по мере кодирования: память не зависит от размера файла.
+       Создаётся только после того, как вход открыт и не пуст */
+    ofstream out;
+    OutputSink sink(out);
+    auto createOutput = [&] {
+        out.open(outPath, std::ios::binary);
+        if (!out) cerr << "Cannot create output: " << outPath << "\n";
+        return static_cast<bool>(out);
+    };
+    uint64_t n = 0;
+    size_t modelBytes = 0;
+
+    if (opt.stream) {
+        /* 1-4) Потоковый интерфейс: кадры по STREAM_FRAME байт */
+        std::ifstream in(inPath, std::ios::binary);
+        if (!in) {
+            cerr << "Cannot open input: " << inPath << "\n";
+            return false;
+        }
+        if (in.peek() == std::ifstream::traits_type::eof()) {
+            cerr << "Input is empty.\n";
+            return false;
+        }
+        if (!createOutput()) return false;
+        uint64_t outSz = 0;
+        if (!encodeFramed(in, opt, out, n, outSz)) {
+            if (in.bad()) cerr << "Read error: " << inPath << "\n";
+            else cerr << "Write error: " << outPath << "\n";
+            out.close();
+            std::filesystem::remove(outPath);
+            return false;
+        }
+        out.close();
+        auto t1 = clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        cout << "Compressed OK\n";
+        cout << "Input:  " << n << " bytes\n";
+        cout << "Output: " << outSz << " bytes\n";
+        cout << "Compression: " << (1.0 - (double)outSz / (double)n) * 100.0 << "%\n";
+        cout << "Time: " << ms << " ms\n";
+        return true;
+    }
+
+    if (opt.engine == ArithEngine::Adaptive || opt.engine == ArithEngine::Ppm || opt.engine == ArithEngine::Cm) {
+        /* 1-4) Адаптивным моделям таблица частот не нужна: кодируем по мере чтения */
+        std::ifstream in(inPath, std::ios::binary);
+        if (!in) {
+            cerr << "Cannot open input: " << inPath << "\n";
+            return false;
+        }
+        if (in.peek() == std::ifstream::traits_type::eof()) {
+            cerr << "Input is empty.\n";
+            return false;
+        }
+        if (!createOutput()) return false;
+        if (opt.engine == ArithEngine::Ppm) {
+            n = encodePpm(in, opt.order, opt.memMb ? opt.memMb : PPM_DEFAULT_MB, sink, modelBytes);
+        } else if (opt.engine == ArithEngine::Cm) {
+            n = encodeCm(in, opt.memMb ? opt.memMb : CM_DEFAULT_MB, sink, modelBytes);
+        } else {
+            n = encodeAdaptive(in, sink);
+        }
+        if (in.bad()) {
+            cerr << "Read error: " << inPath << "\n";
+            out.close();
+            std::filesystem::remove(outPath);
+            return false;
+        }
+    } else {
+        /* 1) Отображаем входной файл в память */
+        MappedFile data;
+        if (!data.open(inPath)) {
+            cerr << "Cannot open input: " << inPath << "\n";
+            return false;
+        }
+        if (data.size() == 0) {
+            cerr << "Input is empty.\n";
+            return false;
+        }
+        if (!createOutput()) return false;
+        const uint8_t* src = data.data();
+        n = data.size();
+
+        /* 2) Строим таблицу частот: 64-битные счётчики, нормировка в движке */
+        WorkerPool pool(resolveThreads(opt.threads));
+        const uint64_t chunkSize = uint64_t(opt.chunkMb) << 20;
+        array<uint64_t, 256> counts{};
+        countHistogram(src, n, pool, counts);
+
+        /* 3-4) Кодирование выбранным движком */
+        switch (opt.engine) {
+        case ArithEngine::Bit:      encodeBitLevel(src, n, counts, chunkSize, pool, sink); break;
+        case ArithEngine::Range:    encodeRange(src, n, counts, chunkSize, pool, sink); break;
+        case ArithEngine::Tans:     encodeTans(src, n, counts, sink); break;
+        case ArithEngine::Rans:     encodeRans(src, n, counts, opt.lanes, sink); break;
+        case ArithEngine::Adaptive:
+        case ArithEngine::Ppm:
+        case ArithEngine::Cm:       break;
+        }
+    }
+
+    /* 5) Дописываем остаток буфера */
+    sink.drain();
+    const uint64_t outSz = sink.written();
+    out.close();
+    if (!out) {
+        cerr << "Write error: " << outPath << "\n";
+        return false;
+    }
+
+    /* 6) Статистика */
+    auto t1 = clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+
+    uint64_t inSz = n;
+    double ratio = (1.0 - (double)outSz / (double)inSz) * 100.0;
+
+    cout << "Compressed OK\n";
+    cout << "Input:  " << inSz << " bytes\n";
+    cout << "Output: " << outSz << " bytes\n";
+    cout << "Compression: " << ratio << "%\n";
+    cout << "Time: " << ms << " ms\n";
+    if (modelBytes != 0) {
+        /* Для PPM и CM размен памяти на скорость: сколько заняли модели и с какой скоростью шли */
+        double sec = std::chrono::duration<double>(t1 - t0).count();
+        cout << "Model memory: " << (modelBytes >> 10) << " KB\n";
+        cout << "Speed: " << (sec > 0 ? (double)inSz / sec / 1e6 : 0.0) << " MB/s\n";
+    }
+    return true;
+}
+
+/* Распаковка (арифметическое декодирование) */
+static bool decompressArithmetic(const string& inPath, const string& outPath, const ArithOptions& opt) {
+    using clock = std::chrono::high_resolution_clock;
+    auto t0 = clock::now();
+
+    if (samePath(inPath, outPath)) {
+        cerr << "Input and output must be different files.\n";
+        return false;
+    }
+
+    /* 0) Самозавершающийся поток читается и пишется последовательно: годятся каналы */
+    {
+        std::ifstream in(inPath, std::ios::binary);
+        if (!in) {
+            cerr << "Cannot open input: " << inPath << "\n";
+            return false;
+        }
+        array<uint8_t, STREAM_HEAD_MAX> head{};
+        in.read(reinterpret_cast<char*>(head.data()), static_cast<std::streamsize>(head.size()));
+        const size_t headSize = static_cast<size_t>(in.gcount());
+
+        ArithHeader h;
+        if (readHeader(head.data(), headSize, h) && h.origSize == SIZE_STREAMED) {
+            ofstream out(outPath, std::ios::binary);
+            if (!out) {
+                cerr << "Cannot create output: " << outPath << "\n";
+                return false;
+            }
+            if (h.framed) {
+                /* Кадры потокового интерфейса: заголовок разбирает сам DecompressStream */
+                if (!decodeFramed(in, head.data(), headSize, out)) {
+                    cerr << "Bad format.\n";
+                    out.close();
+                    std::filesystem::remove(outPath);
+                    return false;
+                }
+            } else {
+                OutputSink sink(out);
+                uint64_t produced = 0;
+                if (!decodeStreamed(ByteInput(in, head.data() + h.size, headSize - h.size), h, sink, produced)) {
+                    cerr << "Bad format.\n";
+                    out.close();
+                    std::filesystem::remove(outPath);
+                    return false;
+                }
+                sink.drain();
+            }
+            out.close();
+            if (!out) {
+                cerr << "Write error: " << outPath << "\n";
+                return false;
+            }
+
+            auto t1 = clock::now();
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+            cout << "Decompressed OK\n";
+            cout << "Time: " << ms << " ms\n";
+            return true;
+        }
+    }
+
+    /* 1) Отображаем сжатый файл в память */
+    MappedFile enc;
+    if (!enc.open(inPath)) {
+        cerr << "Cannot open input: " << inPath << "\n";
+        return false;
+    }
+
+    /* 2) Заголовок: размер результата */
+    uint64_t origSize = 0;
+    if (!decompressedSize(enc.data(), enc.size(), origSize)) {
+        cerr << "Bad format.\n";
+        return false;
+    }
+
+    /* 3) Размер результата известен: пишем прямо в отображённый выходной файл */
+    MappedOutput out;
+    if (!out.create(outPath, origSize)) {
+        cerr << "Cannot create output: " << outPath << "\n";
+        return false;
+    }
+
+    /* 4) Декодирование: движок определяется по magic */
+    size_t written = 0;
+    if (!decompress(enc.data(), enc.size(), out.data(), origSize, opt, written)) {
+        cerr << "Bad format.\n";
+        out.finish(0);
+        std::filesystem::remove(outPath);
+        return false;
+    }
+
+    /* 5) Закрываем выходной файл */
+    if (!out.finish(origSize)) {
+        cerr << "Write error: " << outPath << "\n";
+        return false;
+    }
+
+    /* 6) Время выполнения */
+    auto t1 = clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+
+    cout << "Decompressed OK\n";
+    cout << "Time: " << ms << " ms\n";
+    return true;
+}
+
+/*
+ * Сравнение способов поиска символа на частотах заданного файла, нормированных
+ * к 2^15 так же, как в побитовом и range-кодере: для каждого байта берём точку
+ * внутри его интервала, как её увидит декодер.
+ */
+static void benchmarkSearch(const string& inPath, const ArithOptions& opt) {
+    MappedFile data;
+    if (!data.open(inPath) || data.size() == 0) {
+        cerr << "Cannot open input: " << inPath << "\n";
+        return;
+    }
+
+    array<uint64_t, 256> counts{};
+    WorkerPool pool(resolveThreads(opt.threads));
+    countHistogram(data.data(), data.size(), pool, counts);
+    array<uint32_t, 256> freq{};
+    normalizeFreq(counts, BIT_TOTAL_BITS, freq);
+
+    array<uint32_t, 257> cum{};
+    uint32_t total = 0;
+    buildCum(freq, cum, total);
+
+    const size_t n = std::min<size_t>(data.size(), size_t(1) << 24);
+    std::vector<uint32_t> queries(n);
+    for (size_t i = 0; i < n; i++) {
+        uint8_t b = data.data()[i];
+        queries[i] = cum[b] + static_cast<uint32_t>((i * 2654435761u) % freq[b]);
+    }
+
+    auto run = [&](const char* name, auto find) {
+        using clock = std::chrono::high_resolution_clock;
+        auto t0 = clock::now();
+        uint64_t check = 0;
+        for (size_t i = 0; i < n; i++) check += static_cast<uint64_t>(find(queries[i])) * (i | 1);
+        auto t1 = clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / static_cast<double>(n);
+        cout << name << ": " << ns << " ns/symbol (check " << check << ")\n";
+    };
+
+    cout << "Symbols: " << n << ", total: " << total << "\n";
+    run("linear", LinearSearch(cum));
+    run("binary", BinarySearch(cum));
+    run("simd  ", SimdSearch(cum));
+    run("table ", TableSearch(cum));
+}
+
+/*
+ * Меню программы: выбор режима и ввод имён файлов.
+ * Флаги: --threads N — потоков для подсчёта частот,
+ *        --search linear|binary|simd|table — поиск символа в декодере,
+ *        --engine bit|range|tans|rans|adaptive|ppm|cm — движок сжатия (распаковка определяет его по magic),
+ *        --lanes 8|16 — число дорожек rANS,
+ *        --order 1..4 — порядок PPM, --mem MB — бюджет памяти моделей PPM и CM,
+ *        --chunk MB — независимые куски побитового и range-кодера (параллельно в обе стороны),
+ *        --stream — кадры потокового интерфейса (adaptive, ppm, cm): сброс без конца потока.
+ */
+int main(int argc, char** argv) {
+    ArithOptions opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            opt.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--engine" && i + 1 < argc) {
+            string v = argv[++i];
+            if (v == "bit") opt.engine = ArithEngine::Bit;
+            else if (v == "range") opt.engine = ArithEngine::Range;
+            else if (v == "tans") opt.engine = ArithEngine::Tans;
+            else if (v == "rans") opt.engine = ArithEngine::Rans;
+            else if (v == "adaptive") opt.engine = ArithEngine::Adaptive;
+            else if (v == "ppm") opt.engine = ArithEngine::Ppm;
+            else if (v == "cm") opt.engine = ArithEngine::Cm;
+            else {
+                cerr << "Unknown engine: " << v << "\n";
+                return 1;
+            }
+        } else if (arg == "--lanes" && i + 1 < argc) {
+            opt.lanes = static_cast<uint32_t>(std::atoi(argv[++i]));
+            if (opt.lanes != 8 && opt.lanes != 16) {
+                cerr << "Lanes must be 8 or 16\n";
+                return 1;
+            }
+        } else if (arg == "--order" && i + 1 < argc) {
+            opt.order = static_cast<uint32_t>(std::atoi(argv[++i]));
+            if (opt.order < 1 || opt.order > PPM_MAX_ORDER) {
+                cerr << "Order must be 1.." << PPM_MAX_ORDER << "\n";
+                return 1;
+            }
+        } else if (arg == "--mem" && i + 1 < argc) {
+            opt.memMb = static_cast<uint32_t>(std::atoi(argv[++i]));
+            if (opt.memMb < 1 || opt.memMb > 4096) {
+                cerr << "Memory must be 1..4096 MB\n";
+                return 1;
+            }
+        } else if (arg == "--chunk" && i + 1 < argc) {
+            opt.chunkMb = static_cast<uint32_t>(std::atoi(argv[++i]));
+            if (opt.chunkMb > 1024) {
+                cerr << "Chunk must be 0..1024 MB\n";
+                return 1;
+            }
+        } else if (arg == "--stream") {
+            opt.stream = true;
+        } else if (arg == "--search" && i + 1 < argc) {
+            string v = argv[++i];
+            if (v == "linear") opt.search = SymbolSearch::Linear;
+            else if (v == "binary") opt.search = SymbolSearch::Binary;
+            else if (v == "simd") opt.search = SymbolSearch::Simd;
+            else if (v == "table") opt.search = SymbolSearch::Table;
+            else {
+                cerr << "Unknown search: " << v << "\n";
+                return 1;
+            }
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (opt.chunkMb != 0 && opt.engine != ArithEngine::Bit && opt.engine != ArithEngine::Range) {
+        cerr << "--chunk applies to the bit and range engines\n";
+        return 1;
+    }
+
+    if (opt.stream && opt.engine != ArithEngine::Adaptive && opt.engine != ArithEngine::Ppm && opt.engine != ArithEngine::Cm) {
+        cerr << "--stream applies to the adaptive, ppm and cm engines\n";
+        return 1;
+    }
+
+    cout << "1) Compress (Arithmetic)\n2) Decompress (Arithmetic)\n3) Benchmark symbol search\nChoose: ";
+    int choice = 0;
+    std::cin >> choice;
+
+    string inFile, outFile;
+    cout << "Input file: ";
+    std::cin >> inFile;
+    if (choice == 3) {
+        benchmarkSearch(inFile, opt);
+        return 0;
+    }
     cout << "Output file: ";
     std::cin >> outFile;
 
-    if (choice == 1) compressArithmetic(inFile, outFile);
-    else if (choice == 2) decompressArithmetic(inFile, outFile);
+    bool ok = false;
+    if (choice == 1) ok = compressArithmetic(inFile, outFile, opt);
+    else if (choice == 2) ok = decompressArithmetic(inFile, outFile, opt);
     else cout << "Wrong choice\n";
 
-    return 0;
+    return ok ? 0 : 1;
 }
+#endif
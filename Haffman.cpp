@@ -1,334 +1,1799 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <cstdint>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <queue>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using std::array;
 using std::cerr;
 using std::cout;
-using std::ifstream;
-using std::ofstream;
 using std::string;
 
+/*
+ * Кодек целиком в пространстве имён huff: файл можно собрать в чужую программу
+ * (с HUFF_NO_MAIN) рядом с арифметическим кодеком, и одноимённые классы не
+ * столкнутся. Снаружи нужны compressBound / compress / decompressedSize / decompress.
+ */
+namespace huff {
 
-/* Узел дерева Хаффмана */
-struct Node {
-    uint8_t ch{};
-    uint64_t freq{};
-    Node* left{nullptr};
-    Node* right{nullptr};
-    bool is_leaf{false};
-};
-
-/* Компаратор для priority_queue: на вершине узел с минимальной частотой */
-struct NodeCmp {
-    bool operator()(const Node* a, const Node* b) const {
-        return a->freq > b->freq;
-    }
-};
+/* Запись 8 байт старшим байтом вперёд (компилятор сводит цикл к bswap + mov) */
+static inline void storeBE64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = static_cast<uint8_t>(v >> (56 - 8 * i));
+}
 
-/* Освобождение памяти дерева */
-static void freeTree(Node* n) {
-    if (!n) return;
-    freeTree(n->left);
-    freeTree(n->right);
-    delete n;
+/* Код символа в таблице кодирования: биты кода << 8 | длина */
+static inline uint32_t packCode(uint32_t bits, int len) {
+    return (bits << 8) | static_cast<uint32_t>(len);
 }
 
-/* Запись битов в файл: накапливаем 8 бит -> записываем 1 байт */
+/* Запись битов в память: коды целиком копятся в 64-битном буфере и уходят по 8 байт */
 class BitWriter {
 public:
-    explicit BitWriter(ofstream& out) : out_(out) {}
+    /* dst должен вмещать весь поток: размер известен заранее по частотам и длинам */
+    explicit BitWriter(uint8_t* dst) : dst_(dst) {}
 
-    void writeBit(bool b) {
-        buffer_ = (buffer_ << 1) | (b ? 1 : 0);
-        bits_++;
-        if (bits_ == 8) flushByte();
-    }
+    /* Дописываем len младших бит value, старшим битом вперёд (len <= 32) */
+    void writeBits(uint32_t value, int len) {
+        if (bits_ + len < 64) {
+            acc_ = (acc_ << len) | value;
+            bits_ += len;
+            return;
+        }
 
-    void writeBitsFromString(const string& bits01) {
-        for (char c : bits01) writeBit(c == '1');
-    }
+        /* Буфер заполнился: добиваем его старшими битами кода и сбрасываем 8 байт */
+        int room = 64 - bits_;
+        acc_ = (acc_ << room) | (value >> (len - room));
+        storeBE64(dst_ + pos_, acc_);
+        pos_ += 8;
 
-    /* Дописываем нули до целого байта и сбрасываем остаток */
-    void flushFinal() {
-        if (bits_ == 0) return;
-        buffer_ <<= (8 - bits_);
-        flushByte();
+        /* Биты выше bits_ — мусор, они уйдут за край буфера при следующих сдвигах */
+        acc_ = value;
+        bits_ = len - room;
     }
 
-private:
-    void flushByte() {
-        out_.put(static_cast<char>(buffer_));
-        buffer_ = 0;
-        bits_ = 0;
+    void writeCode(uint32_t packed) { writeBits(packed >> 8, static_cast<int>(packed & 0xFF)); }
+
+    /* Дописываем нули до целого байта; возвращает размер потока в байтах */
+    size_t flushFinal() {
+        if (bits_ > 0) {
+            acc_ <<= (64 - bits_);
+            for (int i = 0; i < (bits_ + 7) / 8; i++) {
+                dst_[pos_++] = static_cast<uint8_t>(acc_ >> (56 - 8 * i));
+            }
+            bits_ = 0;
+        }
+        return pos_;
     }
 
-    ofstream& out_;
-    uint8_t buffer_{0};
+private:
+    uint8_t* dst_;
+    size_t pos_{0};
+    uint64_t acc_{0};
     int bits_{0};
 };
 
-/* Чтение битов: читаем байт и выдаём биты по одному */
+/* Чтение 8 байт старшим байтом вперёд */
+static inline uint64_t loadBE64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * Чтение битов из памяти: 64-битное окно, старший бит — следующий бит потока.
+ * refill() дополняет окно минимум до 56 бит одним чтением 8 байт, после чего
+ * peekBits/consume работают без ветвлений. За концом данных читаются нули.
+ */
 class BitReader {
 public:
-    explicit BitReader(ifstream& in) : in_(in) {}
+    BitReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
 
-    bool readBit(bool& bit) {
-        if (bits_left_ == 0) {
-            char c;
-            if (!in_.get(c)) return false;
-            buffer_ = static_cast<uint8_t>(c);
-            bits_left_ = 8;
+    void refill() {
+        if (pos_ + 8 <= size_) {
+            /* Лишние младшие биты слова совпадут с тем, что дочитаем в следующий раз */
+            acc_ |= loadBE64(data_ + pos_) >> bits_;
+            pos_ += (63 - bits_) >> 3;
+            bits_ |= 56;
+            return;
         }
-        bit = ((buffer_ >> (bits_left_ - 1)) & 1) != 0;
-        bits_left_--;
-        return true;
+        while (bits_ <= 56) {
+            uint64_t byte = pos_ < size_ ? data_[pos_] : 0;
+            acc_ |= byte << (56 - bits_);
+            pos_++;
+            bits_ += 8;
+        }
+    }
+
+    /* Следующие n бит (1 <= n <= 56 после refill) без сдвига позиции */
+    uint32_t peekBits(int n) const { return static_cast<uint32_t>(acc_ >> (64 - n)); }
+
+    void consume(int n) {
+        acc_ <<= n;
+        bits_ -= n;
     }
 
+    /* Прочитано больше бит, чем есть в данных */
+    bool overrun() const { return pos_ * 8 - static_cast<size_t>(bits_) > size_ * 8; }
+
 private:
-    ifstream& in_;
-    uint8_t buffer_{0};
-    int bits_left_{0};
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_{0};
+    uint64_t acc_{0};
+    int bits_{0};
 };
 
-/* Обход дерева и построение кодов: влево -> '0', вправо -> '1' */
-static void buildCodes(Node* n, string cur, array<string, 256>& codes) {
-    if (!n) return;
+/* Параметры кодов и табличного декодера */
+constexpr int MIN_CODE_LEN = 8;     // меньше не хватит на 256 символов
+constexpr int MAX_CODE_LEN = 15;    // верхняя граница для флага --max-len
+constexpr int DEFAULT_MAX_LEN = 11; // по умолчанию код помещается в первый уровень таблицы
+constexpr int ROOT_BITS = 11;       // разрядность таблицы первого уровня
+constexpr uint32_t HUFF_MAGIC = 0x48464634;   // "HFF4"
+constexpr uint32_t HUFF_MAGIC_V1 = 0x48464631;    // "HFF1": дерево по частотам, только чтение
+constexpr uint32_t HUFF_MAGIC_V2 = 0x48464632;    // "HFF2": канонический код одним потоком, только чтение
+constexpr uint32_t HUFF_MAGIC_V3 = 0x48464633;    // "HFF3": один или четыре потока без блоков, только чтение
+constexpr uint32_t HUFF_STREAM_MAGIC = 0x48465331;    // "HFS1": кадры потокового интерфейса
+constexpr size_t MIN_BLOCK_SIZE = 1 << 10;
+constexpr size_t MAX_BLOCK_SIZE = size_t(1) << 30;
+constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
 
-    if (n->is_leaf) {
-        /* Случай файла из одного символа: пустой путь заменяем на "0" */
-        codes[n->ch] = cur.empty() ? "0" : cur;
+/* Параметры кодирования из командной строки */
+struct HuffOptions {
+    int maxCodeLen{DEFAULT_MAX_LEN};    // --max-len: предел длины кода
+    int streams{1};                     // --streams: 1 или 4 независимых битовых потока
+    size_t blockSize{DEFAULT_BLOCK_SIZE};   // --block-size: байт исходных данных на блок
+    unsigned threads{0};                // --threads: 0 — по числу ядер
+    bool stream{false};                 // --stream: кадры потокового интерфейса
+};
+
+/* Параметры, с которыми блоки можно записать и прочитать обратно */
+static bool validOptions(const HuffOptions& opt) {
+    return (opt.streams == 1 || opt.streams == 4) && opt.blockSize >= MIN_BLOCK_SIZE &&
+           opt.blockSize <= MAX_BLOCK_SIZE && opt.maxCodeLen >= MIN_CODE_LEN && opt.maxCodeLen <= MAX_CODE_LEN;
+}
+
+/* Элемент таблицы: либо символ с длиной кода, либо ссылка на подтаблицу */
+struct DecodeEntry {
+    uint32_t value{0};      // символ или индекс начала подтаблицы
+    uint8_t len{0};         // полная длина кода символа
+    uint8_t subBits{0};     // != 0 — ссылка на подтаблицу такой разрядности
+};
+
+/* Символы с ненулевой частотой по возрастанию (частота, символ); возвращает их число */
+static int sortLeaves(const array<uint64_t, 256>& freq, array<uint8_t, 256>& sym) {
+    int n = 0;
+    for (int s = 0; s < 256; s++) {
+        if (freq[s] > 0) sym[n++] = static_cast<uint8_t>(s);
+    }
+    std::sort(sym.begin(), sym.begin() + n, [&](uint8_t a, uint8_t b) {
+        return freq[a] != freq[b] ? freq[a] < freq[b] : a < b;
+    });
+    return n;
+}
+
+/*
+ * Длины кодов Хаффмана без дерева и без выделения памяти (Moffat–Katajainen):
+ * в отсортированном массиве весов на месте строятся ссылки на родителей,
+ * затем глубины внутренних узлов, затем глубины листьев.
+ * Возвращает максимальную длину; единственный символ получает длину 1.
+ */
+static int huffmanLengths(const array<uint64_t, 256>& freq, array<uint8_t, 256>& lens) {
+    array<uint8_t, 256> sym{};
+    const int n = sortLeaves(freq, sym);
+
+    lens.fill(0);
+    if (n == 0) return 0;
+    if (n == 1) {
+        lens[sym[0]] = 1;
+        return 1;
+    }
+
+    array<uint64_t, 256> a{};
+    for (int i = 0; i < n; i++) a[i] = freq[sym[i]];
+
+    /* 1) Слева направо: веса внутренних узлов, в узлах-потомках — индекс родителя */
+    int root = 0;
+    int leaf = 2;
+    a[0] += a[1];
+    for (int next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = static_cast<uint64_t>(next);
+        } else {
+            a[next] = a[leaf++];
+        }
+
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = static_cast<uint64_t>(next);
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+
+    /* 2) Справа налево: глубины внутренних узлов */
+    a[n - 2] = 0;
+    for (int next = n - 3; next >= 0; next--) a[next] = a[a[next]] + 1;
+
+    /* 3) Справа налево: глубины листьев (у самых частых — наименьшие) */
+    int avail = 1;
+    int used = 0;
+    uint64_t depth = 0;
+    int next = n - 1;
+    root = n - 2;
+    while (avail > 0) {
+        while (root >= 0 && a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (avail > used) {
+            a[next--] = depth;
+            avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+
+    /* Листья шли по возрастанию частоты, поэтому a[0] — самый длинный код */
+    for (int i = 0; i < n; i++) lens[sym[i]] = static_cast<uint8_t>(a[i] < 255 ? a[i] : 255);
+    return static_cast<int>(a[0]);
+}
+
+/*
+ * Длины кодов не длиннее limit (package-merge): оптимальный префиксный код
+ * среди всех кодов с ограниченной длиной. Списки хранятся в массивах на стеке.
+ */
+static void limitedLengths(const array<uint64_t, 256>& freq, int limit, array<uint8_t, 256>& lens) {
+    /* 1) Листья по возрастанию частоты */
+    array<uint8_t, 256> sym{};
+    const int n = sortLeaves(freq, sym);
+
+    lens.fill(0);
+    if (n == 0) return;
+    if (n == 1) {
+        lens[sym[0]] = 1;
         return;
     }
 
-    buildCodes(n->left, cur + "0", codes);
-    buildCodes(n->right, cur + "1", codes);
+    /* 2) Уровень j: слияние листьев с парами элементов уровня j-1 */
+    array<array<uint8_t, 512>, MAX_CODE_LEN> isPackage{};
+    array<int, MAX_CODE_LEN> size{};
+    array<uint64_t, 512> prev{};
+    array<uint64_t, 512> cur{};
+
+    for (int i = 0; i < n; i++) prev[i] = freq[sym[i]];
+    size[0] = n;
+
+    for (int j = 1; j < limit; j++) {
+        int packages = size[j - 1] / 2;
+        int li = 0, pi = 0, k = 0;
+        while (li < n || pi < packages) {
+            uint64_t pw = pi < packages ? prev[2 * pi] + prev[2 * pi + 1] : 0;
+            if (pi >= packages || (li < n && freq[sym[li]] <= pw)) {
+                cur[k] = freq[sym[li++]];
+                isPackage[j][k++] = 0;
+            } else {
+                cur[k] = pw;
+                isPackage[j][k++] = 1;
+                pi++;
+            }
+        }
+        size[j] = k;
+        prev = cur;
+    }
+
+    /* 3) Берём 2n-2 первых элемента верхнего уровня и раскрываем пакеты вниз */
+    int take = 2 * n - 2;
+    for (int j = limit - 1; j >= 0; j--) {
+        int leaves = 0;
+        for (int k = 0; k < take; k++) {
+            if (!isPackage[j][k]) leaves++;
+        }
+        /* В каждом списке листья идут в порядке возрастания частоты */
+        for (int i = 0; i < leaves; i++) lens[sym[i]]++;
+        take = 2 * (take - leaves);
+    }
+}
+
+/* Канонические коды: короткие коды меньше длинных, внутри длины — по порядку символов */
+static void assignCanonicalCodes(const array<uint8_t, 256>& lens, array<uint32_t, 256>& codes) {
+    array<uint32_t, MAX_CODE_LEN + 1> count{};
+    for (int s = 0; s < 256; s++) count[lens[s]]++;
+    count[0] = 0;
+
+    array<uint32_t, MAX_CODE_LEN + 1> next{};
+    uint32_t code = 0;
+    for (int len = 1; len <= MAX_CODE_LEN; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    for (int s = 0; s < 256; s++) {
+        codes[s] = lens[s] ? next[lens[s]]++ : 0;
+    }
 }
 
-/* Построение дерева Хаффмана по частотам */
-static Node* buildHuffmanTree(const array<uint64_t, 256>& freq, uint16_t& uniqueCount) {
-    std::priority_queue<Node*, std::vector<Node*>, NodeCmp> pq;
-    uniqueCount = 0;
+/* Проверка длин из заголовка: код должен быть полным префиксным (или из одного символа) */
+static bool checkLengths(const array<uint8_t, 256>& lens, int& maxLen, int& symbols) {
+    array<uint32_t, MAX_CODE_LEN + 1> count{};
+    maxLen = 0;
+    symbols = 0;
+    for (int s = 0; s < 256; s++) {
+        if (lens[s] == 0) continue;
+        if (lens[s] > MAX_CODE_LEN) return false;
+        count[lens[s]]++;
+        symbols++;
+        if (lens[s] > maxLen) maxLen = lens[s];
+    }
+
+    if (symbols == 0) return false;
+    if (symbols == 1) return true;
+
+    /* left — сколько кодов текущей длины ещё свободно */
+    uint64_t left = 1;
+    for (int len = 1; len <= maxLen; len++) {
+        left <<= 1;
+        if (count[len] > left) return false;
+        left -= count[len];
+    }
+    return left == 0;
+}
+
+/*
+ * Двухуровневая таблица по каноническим кодам: длинные коды уходят в подтаблицы.
+ * Подтаблиц не больше, чем символов, и каждая не шире 2^(MAX_CODE_LEN - ROOT_BITS),
+ * поэтому таблица помещается в массив фиксированного размера на стеке.
+ */
+constexpr size_t DECODE_TABLE_MAX = (size_t(1) << ROOT_BITS) + 256 * (size_t(1) << (MAX_CODE_LEN - ROOT_BITS));
+
+static void buildDecodeTable(const array<uint8_t, 256>& lens,
+                             const array<uint32_t, 256>& codes,
+                             array<DecodeEntry, DECODE_TABLE_MAX>& table) {
+    size_t used = size_t(1) << ROOT_BITS;
+    std::fill(table.begin(), table.begin() + used, DecodeEntry{});
+
+    /* 1) Для каждого префикса первого уровня — максимальная длина кода под ним */
+    array<uint8_t, (1 << ROOT_BITS)> subLen{};
+    for (int s = 0; s < 256; s++) {
+        int len = lens[s];
+        if (len <= ROOT_BITS) continue;
+        uint64_t prefix = codes[s] >> (len - ROOT_BITS);
+        if (len > subLen[prefix]) subLen[prefix] = static_cast<uint8_t>(len);
+    }
+
+    /* 2) Выделяем подтаблицы */
+    for (size_t prefix = 0; prefix < subLen.size(); prefix++) {
+        if (subLen[prefix] == 0) continue;
+        int subBits = subLen[prefix] - ROOT_BITS;
+        size_t subBase = used;
+        used += size_t(1) << subBits;
+        std::fill(table.begin() + subBase, table.begin() + used, DecodeEntry{});
+        table[prefix].value = static_cast<uint32_t>(subBase);
+        table[prefix].subBits = static_cast<uint8_t>(subBits);
+    }
+
+    /* 3) Код длины len занимает 2^(bits - len) подряд идущих ячеек */
+    for (int s = 0; s < 256; s++) {
+        int len = lens[s];
+        if (len == 0) continue;
 
-    /* 1) Создаём листья для всех символов с ненулевой частотой */
-    for (int i = 0; i < 256; i++) {
-        if (freq[i] > 0) {
-            uniqueCount++;
-            Node* leaf = new Node{};
-            leaf->ch = static_cast<uint8_t>(i);
-            leaf->freq = freq[i];
-            leaf->is_leaf = true;
-            pq.push(leaf);
+        size_t base = 0;
+        int bits = ROOT_BITS;
+        uint64_t code = codes[s];
+        int rest = len;
+
+        if (len > ROOT_BITS) {
+            const DecodeEntry& link = table[code >> (len - ROOT_BITS)];
+            base = link.value;
+            bits = link.subBits;
+            rest = len - ROOT_BITS;
+            code &= (1ULL << rest) - 1;
+        }
+
+        size_t first = base + (code << (bits - rest));
+        size_t count = size_t(1) << (bits - rest);
+        for (size_t i = 0; i < count; i++) {
+            table[first + i].value = static_cast<uint32_t>(s);
+            table[first + i].len = static_cast<uint8_t>(len);
         }
     }
+}
+
+/* Один символ по таблице: в окне должно быть не меньше MAX_CODE_LEN бит */
+static inline uint8_t decodeSymbol(const DecodeEntry* table, BitReader& br) {
+    DecodeEntry e = table[br.peekBits(ROOT_BITS)];
+    if (e.subBits != 0) {
+        br.consume(ROOT_BITS);
+        e = table[e.value + br.peekBits(e.subBits)];
+        br.consume(e.len - ROOT_BITS);
+    } else {
+        br.consume(e.len);
+    }
+    return static_cast<uint8_t>(e.value);
+}
+
+/* Кодирование n символов в один поток; возвращает его размер в байтах */
+static size_t encodeStream(const uint8_t* src, size_t n, const array<uint32_t, 256>& codes, uint8_t* dst) {
+    BitWriter bw(dst);
+    for (size_t i = 0; i < n; i++) bw.writeCode(codes[src[i]]);
+    return bw.flushFinal();
+}
 
-    if (pq.empty()) return nullptr;
+/* Декодирование одного потока; false — поток кончился раньше времени */
+static bool decodeStream(const DecodeEntry* table, const uint8_t* src, size_t size, uint8_t* dst, size_t n) {
+    BitReader br(src, size);
+    size_t i = 0;
+
+    /* Одного пополнения окна (56 бит) хватает на три кода по 15 бит */
+    for (; i + 3 <= n; i += 3) {
+        br.refill();
+        dst[i] = decodeSymbol(table, br);
+        dst[i + 1] = decodeSymbol(table, br);
+        dst[i + 2] = decodeSymbol(table, br);
+    }
+    for (; i < n; i++) {
+        br.refill();
+        dst[i] = decodeSymbol(table, br);
+    }
+    return !br.overrun();
+}
 
-    /* 2) Если символ один — дерево состоит из одного листа */
-    if (pq.size() == 1) return pq.top();
+/*
+ * Четыре потока: символы делятся на четверти (последняя забирает остаток),
+ * каждая кодируется отдельно. Декодер ведёт четыре независимых чтения
+ * в одном цикле — процессор выполняет их параллельно.
+ */
+static bool decodeFourStreams(const DecodeEntry* table, const uint8_t* const src[4],
+                              const size_t size[4], uint8_t* dst, size_t n) {
+    size_t quarter = n / 4;
+    uint8_t* o0 = dst;
+    uint8_t* o1 = dst + quarter;
+    uint8_t* o2 = dst + 2 * quarter;
+    uint8_t* o3 = dst + 3 * quarter;
 
-    /* 3) Объединяем два минимальных узла, пока не останется один корень */
-    while (pq.size() > 1) {
-        Node* a = pq.top(); pq.pop();
-        Node* b = pq.top(); pq.pop();
+    BitReader b0(src[0], size[0]);
+    BitReader b1(src[1], size[1]);
+    BitReader b2(src[2], size[2]);
+    BitReader b3(src[3], size[3]);
 
-        Node* parent = new Node{};
-        parent->freq = a->freq + b->freq;
-        parent->left = a;
-        parent->right = b;
-        parent->is_leaf = false;
+    size_t i = 0;
+    for (; i + 3 <= quarter; i += 3) {
+        b0.refill();
+        b1.refill();
+        b2.refill();
+        b3.refill();
+        for (size_t k = i; k < i + 3; k++) {
+            o0[k] = decodeSymbol(table, b0);
+            o1[k] = decodeSymbol(table, b1);
+            o2[k] = decodeSymbol(table, b2);
+            o3[k] = decodeSymbol(table, b3);
+        }
+    }
+    for (; i < quarter; i++) {
+        b0.refill();
+        b1.refill();
+        b2.refill();
+        b3.refill();
+        o0[i] = decodeSymbol(table, b0);
+        o1[i] = decodeSymbol(table, b1);
+        o2[i] = decodeSymbol(table, b2);
+        o3[i] = decodeSymbol(table, b3);
+    }
 
-        pq.push(parent);
+    /* Хвост последней четверти */
+    for (size_t k = 3 * quarter + i; k < n; k++) {
+        b3.refill();
+        dst[k] = decodeSymbol(table, b3);
     }
 
-    return pq.top();
+    return !b0.overrun() && !b1.overrun() && !b2.overrun() && !b3.overrun();
+}
+
+/* Запись целого числа по 7 бит, старший бит байта — «есть продолжение» */
+static uint8_t* putVarint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = static_cast<uint8_t>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(v);
+    return p;
 }
 
-/* Чтение входного файла целиком в память */
-static bool readWholeFile(const string& path, std::vector<uint8_t>& data) {
-    ifstream in(path, std::ios::binary);
-    if (!in) return false;
+static size_t varintSize(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
 
-    in.seekg(0, std::ios::end);
-    std::streamoff sz = in.tellg();
-    in.seekg(0, std::ios::beg);
+static bool readVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) return false;
+        uint8_t byte = *p++;
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
 
-    data.resize(static_cast<size_t>(sz));
-    if (sz > 0) in.read(reinterpret_cast<char*>(data.data()), sz);
+/*
+ * Таблица длин в заголовке: байт = 2 бита вида + 6 бит значения
+ *   00 vvvvvv — одна длина v
+ *   01 vvvvvv — предыдущая длина повторяется ещё v+1 раз
+ *   10 vvvvvv — v+1 нулевых длин (символы без кода)
+ */
+static uint8_t* putLengths(uint8_t* p, const array<uint8_t, 256>& lens) {
+    int i = 0;
+    while (i < 256) {
+        int run = 1;
+        while (i + run < 256 && lens[i + run] == lens[i] && run < 64) run++;
 
-    return true;
+        if (lens[i] == 0) {
+            *p++ = static_cast<uint8_t>(0x80 | (run - 1));
+            i += run;
+            continue;
+        }
+
+        *p++ = lens[i];
+        if (run > 1) *p++ = static_cast<uint8_t>(0x40 | (run - 2));
+        i += run;
+    }
+    return p;
 }
 
-/* Получение размера файла для статистики */
-static uint64_t fileSize(const string& path) {
-    ifstream in(path, std::ios::binary | std::ios::ate);
-    return in ? static_cast<uint64_t>(in.tellg()) : 0ULL;
+static bool readLengths(const uint8_t*& p, const uint8_t* end, array<uint8_t, 256>& lens) {
+    int i = 0;
+    uint8_t prev = 0;
+    while (i < 256) {
+        if (p == end) return false;
+        uint8_t byte = *p++;
+        uint8_t v = byte & 0x3F;
+
+        switch (byte >> 6) {
+        case 0:
+            lens[i++] = prev = v;
+            break;
+        case 1:
+            if (prev == 0 || i + v + 1 > 256) return false;
+            for (int k = 0; k <= v; k++) lens[i++] = prev;
+            break;
+        case 2:
+            if (i + v + 1 > 256) return false;
+            for (int k = 0; k <= v; k++) lens[i++] = 0;
+            prev = 0;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
 }
 
-/* Кодирование файла */
-static void encodeFile(const string& inPath, const string& outPath) {
-    /* 1) Читаем входной файл */
-    std::vector<uint8_t> data;
+/*
+ * Входной файл, отображённый в память: данные читаются прямо из страничного
+ * кэша, без копии в буфер. Система предупреждена о последовательном чтении.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
 
-    if (!readWholeFile(inPath, data)) {
-        cerr << "Cannot open input: " << inPath << "\n";
-        return;
+    bool open(const string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file_, &sz)) return false;
+        size_ = static_cast<size_t>(sz.QuadPart);
+        if (size_ == 0) return true;
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!map_) return false;
+        data_ = static_cast<const uint8_t*>(MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0));
+        return data_ != nullptr;
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return false;
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) return true;
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const uint8_t*>(p);
+        return true;
+#endif
     }
-    if (data.empty()) {
-        cerr << "Input is empty.\n";
-        return;
+
+    void close() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        map_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
     }
 
-    /* 2) Считаем частоты */
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE map_{nullptr};
+#else
+    int fd_{-1};
+#endif
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+};
+
+/*
+ * Выходной файл заранее известного максимального размера, отображённый в память:
+ * результат пишется прямо в страницы файла. finish() снимает отображение
+ * и обрезает файл до фактического размера.
+ */
+class MappedOutput {
+public:
+    MappedOutput() = default;
+    MappedOutput(const MappedOutput&) = delete;
+    MappedOutput& operator=(const MappedOutput&) = delete;
+    ~MappedOutput() { finish(size_); }
+
+    bool create(const string& path, size_t size) {
+        size_ = size;
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        if (size == 0) return true;
+        uint64_t sz = size;
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+                                  static_cast<DWORD>(sz >> 32), static_cast<DWORD>(sz), nullptr);
+        if (!map_) return false;
+        data_ = static_cast<uint8_t*>(MapViewOfFile(map_, FILE_MAP_WRITE, 0, 0, 0));
+        return data_ != nullptr;
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) return false;
+        if (size == 0) return true;
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) return false;
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        data_ = static_cast<uint8_t*>(p);
+        return true;
+#endif
+    }
+
+    uint8_t* data() { return data_; }
+
+    bool finish(size_t finalSize) {
+        bool ok = true;
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER pos;
+            pos.QuadPart = static_cast<LONGLONG>(finalSize);
+            ok = SetFilePointerEx(file_, pos, nullptr, FILE_BEGIN) && SetEndOfFile(file_);
+            CloseHandle(file_);
+        }
+        map_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap(data_, size_);
+        if (fd_ >= 0) {
+            if (finalSize != size_) ok = ftruncate(fd_, static_cast<off_t>(finalSize)) == 0;
+            ok = (::close(fd_) == 0) && ok;
+        }
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        return ok;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE map_{nullptr};
+#else
+    int fd_{-1};
+#endif
+    uint8_t* data_{nullptr};
+    size_t size_{0};
+};
+
+/*
+ * Пул из threads потоков на одну операцию: рабочие потоки создаются при первом
+ * run() с несколькими задачами и дальше ждут следующих, вызывающий поток
+ * работает вместе с ними. run(count, fn) выполняет fn(0..count-1): каждый
+ * поток берёт следующий свободный номер, поэтому неравные по времени задачи
+ * распределяются сами. При threads == 1 потоков нет и run() выполняет задачи
+ * на месте, без выделения памяти.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads) : threads_(threads ? threads : 1) {}
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& th : workers_) th.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return threads_; }
+
+    template <class Fn>
+    void run(size_t count, Fn fn) {
+        if (threads_ == 1 || count <= 1) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+        if (workers_.empty()) {
+            for (unsigned t = 1; t < threads_; t++) workers_.emplace_back([this] { loop(); });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = [](void* ctx, size_t i) { (*static_cast<Fn*>(ctx))(i); };
+            ctx_ = &fn;
+            count_ = count;
+            next_ = 0;
+            busy_ = workers_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+        work();
+
+        /* Следующий run() начинается, только когда все рабочие вернулись к ожиданию */
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return busy_ == 0; });
+    }
+
+private:
+    void work() {
+        for (size_t i = next_++; i < count_; i = next_++) task_(ctx_, i);
+    }
+
+    void loop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+
+    unsigned threads_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    void (*task_)(void*, size_t){nullptr};
+    void* ctx_{nullptr};
+    size_t count_{0};
+    std::atomic<size_t> next_{0};
+    size_t busy_{0};
+    uint64_t generation_{0};
+    bool stop_{false};
+};
+
+static unsigned resolveThreads(unsigned threads) {
+    if (threads != 0) return threads;
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+/*
+ * Гистограмма байтов в один поток. Четыре подтаблицы по очереди: подряд
+ * идущие одинаковые байты попадают в разные счётчики и не ждут друг друга
+ * (запись в счётчик и следующее его чтение иначе выстраиваются в цепочку).
+ * Счётчики 32-битные, поэтому вход обрабатывается кусками по HIST_CHUNK байт.
+ */
+constexpr size_t HIST_CHUNK = size_t(1) << 30;
+
+static void countBytes(const uint8_t* p, size_t n, array<uint64_t, 256>& freq) {
+    array<array<uint32_t, 256>, 4> t;
+    while (n > 0) {
+        size_t chunk = n < HIST_CHUNK ? n : HIST_CHUNK;
+        for (array<uint32_t, 256>& row : t) row.fill(0);
+
+        size_t i = 0;
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t w;
+            std::memcpy(&w, p + i, sizeof(w));
+            t[0][w & 0xFF]++;
+            t[1][(w >> 8) & 0xFF]++;
+            t[2][(w >> 16) & 0xFF]++;
+            t[3][(w >> 24) & 0xFF]++;
+            t[0][(w >> 32) & 0xFF]++;
+            t[1][(w >> 40) & 0xFF]++;
+            t[2][(w >> 48) & 0xFF]++;
+            t[3][w >> 56]++;
+        }
+        for (; i < chunk; i++) t[0][p[i]]++;
+
+        for (int s = 0; s < 256; s++) {
+            freq[s] += static_cast<uint64_t>(t[0][s]) + t[1][s] + t[2][s] + t[3][s];
+        }
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+/* План блока: всё, что нужно, чтобы записать его сразу на окончательное место */
+struct BlockPlan {
+    array<uint8_t, 256> lens{};
+    int symbols{0};                 // число разных символов в блоке
+    array<size_t, 4> streamSize{};  // точные размеры потоков в байтах
+    size_t size{0};                 // размер блока без префикса длины
+    size_t offset{0};               // смещение префикса длины в выходном файле
+};
+
+/* Длины кодов блока и точные размеры потоков (по частотам каждой четверти) */
+static void planBlock(const uint8_t* src, size_t n, const HuffOptions& opt, BlockPlan& plan) {
+    /* 1) Частоты каждого будущего потока (блоки и так считаются параллельно) */
+    const int streams = opt.streams;
+    const size_t quarter = n / 4;
+    array<array<uint64_t, 256>, 4> part{};
     array<uint64_t, 256> freq{};
-    for (uint8_t b : data) freq[b]++;
 
-    /* 3) Строим дерево и таблицу кодов */
-    uint16_t uniqueCount = 0;
-    Node* root = buildHuffmanTree(freq, uniqueCount);
-    if (!root) {
-        cerr << "Tree build error.\n";
-        return;
+    for (int k = 0; k < streams; k++) {
+        size_t from = streams == 1 ? 0 : k * quarter;
+        size_t to = (streams == 1 || k == 3) ? n : from + quarter;
+        countBytes(src + from, to - from, part[k]);
+    }
+    for (int k = 0; k < streams; k++) {
+        for (int s = 0; s < 256; s++) freq[s] += part[k][s];
     }
 
-    array<string, 256> codes{};
-    buildCodes(root, "", codes);
+    /* 2) Длины кодов Хаффмана; слишком длинные — ограничиваем */
+    int maxLen = huffmanLengths(freq, plan.lens);
+    if (maxLen > opt.maxCodeLen) limitedLengths(freq, opt.maxCodeLen, plan.lens);
+    plan.symbols = 0;
+    for (int s = 0; s < 256; s++) plan.symbols += freq[s] > 0;
 
-    /* 4) Открываем выходной файл и пишем заголовок + таблицу частот */
-    ofstream out(outPath, std::ios::binary);
-    if (!out) {
-        cerr << "Cannot create output: " << outPath << "\n";
-        freeTree(root);
+    /* 3) Размер блока: таблица длин + таблица переходов + потоки */
+    array<uint8_t, 256> tmp{};
+    plan.size = static_cast<size_t>(putLengths(tmp.data(), plan.lens) - tmp.data());
+    if (plan.symbols == 1) return;
+
+    for (int k = 0; k < streams; k++) {
+        uint64_t bits = 0;
+        for (int s = 0; s < 256; s++) bits += part[k][s] * plan.lens[s];
+        plan.streamSize[k] = static_cast<size_t>((bits + 7) / 8);
+        plan.size += plan.streamSize[k];
+        if (streams == 4 && k < 3) plan.size += varintSize(plan.streamSize[k]);
+    }
+}
+
+/* Запись блока по плану: префикс длины, таблица длин, таблица переходов, потоки */
+static void emitBlock(const uint8_t* src, size_t n, const HuffOptions& opt,
+                      const BlockPlan& plan, uint8_t* dst) {
+    uint8_t* p = putVarint(dst, plan.size);
+    p = putLengths(p, plan.lens);
+    if (plan.symbols == 1) return;
+
+    array<uint32_t, 256> canon{};
+    assignCanonicalCodes(plan.lens, canon);
+    array<uint32_t, 256> codes{};
+    for (int s = 0; s < 256; s++) codes[s] = packCode(canon[s], plan.lens[s]);
+
+    if (opt.streams == 1) {
+        encodeStream(src, n, codes, p);
         return;
     }
 
-    const uint32_t magic = 0x48464631;                 // "HFF1"
-    const uint64_t origSize = static_cast<uint64_t>(data.size());
+    size_t quarter = n / 4;
+    for (int k = 0; k < 3; k++) p = putVarint(p, plan.streamSize[k]);
+    for (int k = 0; k < 4; k++) {
+        size_t count = k < 3 ? quarter : n - 3 * quarter;
+        encodeStream(src + k * quarter, count, codes, p);
+        p += plan.streamSize[k];
+    }
+}
+
+/* Распаковка блока из n символов; false — блок повреждён */
+static bool decodeBlock(const uint8_t* p, size_t size, int streams, uint8_t* dst, size_t n) {
+    const uint8_t* end = p + size;
 
-    out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
-    out.write(reinterpret_cast<const char*>(&origSize), sizeof(origSize));
-    out.write(reinterpret_cast<const char*>(&uniqueCount), sizeof(uniqueCount));
+    /* 1) Длины кодов */
+    array<uint8_t, 256> lens{};
+    int maxLen = 0;
+    int symbols = 0;
+    if (!readLengths(p, end, lens) || !checkLengths(lens, maxLen, symbols)) return false;
 
-    for (int i = 0; i < 256; i++) {
-        if (freq[i] > 0) {
-            uint8_t sym = static_cast<uint8_t>(i);
-            out.put(static_cast<char>(sym));
-            out.write(reinterpret_cast<const char*>(&freq[i]), sizeof(uint64_t));
+    /* 2) Частный случай: один символ во всём блоке */
+    if (symbols == 1) {
+        for (int s = 0; s < 256; s++) {
+            if (lens[s]) std::memset(dst, s, n);
         }
+        return true;
     }
 
-    /* 5) Пишем закодированные данные как битовый поток */
-    BitWriter bw(out);
-    for (uint8_t b : data) bw.writeBitsFromString(codes[b]);
-    bw.flushFinal();
+    /* 3) Таблица переходов: где начинается каждый из четырёх потоков */
+    array<const uint8_t*, 4> streamPtr{};
+    array<size_t, 4> streamSize{};
+    if (streams == 4) {
+        for (int k = 0; k < 3; k++) {
+            uint64_t sz = 0;
+            if (!readVarint(p, end, sz)) return false;
+            streamSize[k] = static_cast<size_t>(sz);
+        }
+        const uint8_t* q = p;
+        for (int k = 0; k < 3; k++) {
+            if (streamSize[k] > static_cast<size_t>(end - q)) return false;
+            streamPtr[k] = q;
+            q += streamSize[k];
+        }
+        streamPtr[3] = q;
+        streamSize[3] = static_cast<size_t>(end - q);
+    }
 
-    out.close();
+    /* 4) Каждый символ занимает хотя бы бит — больший размер означает порчу */
+    size_t payload = static_cast<size_t>(end - p);
+    if (n > payload * 8) return false;
 
-    /* 6) Вывод статистики */
-    uint64_t inSz = static_cast<uint64_t>(data.size());
-    uint64_t outSz = fileSize(outPath);
-    double ratio = (1.0 - (double)outSz / (double)inSz) * 100.0;
+    array<uint32_t, 256> codes{};
+    assignCanonicalCodes(lens, codes);
+    array<DecodeEntry, DECODE_TABLE_MAX> table;
+    buildDecodeTable(lens, codes, table);
 
-    cout << "Encoded OK\n";
-    cout << "Input:  " << inSz << " bytes\n";
-    cout << "Output: " << outSz << " bytes\n";
-    cout << "Compression: " << ratio << "%\n";
+    if (streams == 1) return decodeStream(table.data(), p, payload, dst, n);
+    return decodeFourStreams(table.data(), streamPtr.data(), streamSize.data(), dst, n);
+}
+
+/*
+ * Старые форматы — один блок на весь файл, только чтение:
+ * HFF1 — u64 размер | u16 число символов | (символ, u64 частота) | поток;
+ *        коды — пути в дереве, которое строила очередь с приоритетом по частотам;
+ * HFF2 — varint размер | таблица длин | канонический поток (длины до 63 бит);
+ * HFF3 — varint размер | потоков (1 байт) | тело блока нынешнего формата.
+ */
+struct LegacyHeader {
+    uint32_t magic{0};
+    uint64_t origSize{0};
+    int streams{1};
+    array<uint64_t, 256> freq{};    // HFF1: частоты, по ним восстанавливается дерево
+};
+
+static bool readLegacyHeader(const uint8_t*& p, const uint8_t* end, LegacyHeader& h) {
+    if (static_cast<size_t>(end - p) < sizeof(h.magic)) return false;
+    std::memcpy(&h.magic, p, sizeof(h.magic));
+
+    if (h.magic == HUFF_MAGIC_V1) {
+        uint16_t unique = 0;
+        if (static_cast<size_t>(end - p) < sizeof(h.magic) + sizeof(h.origSize) + sizeof(unique)) return false;
+        std::memcpy(&h.origSize, p + 4, sizeof(h.origSize));
+        std::memcpy(&unique, p + 12, sizeof(unique));
+        p += 14;
+        if (unique == 0 || unique > 256 || static_cast<size_t>(end - p) < unique * 9u) return false;
+        for (int i = 0; i < unique; i++) {
+            uint64_t f = 0;
+            std::memcpy(&f, p + 1, sizeof(f));
+            if (f == 0 || h.freq[p[0]] != 0) return false;
+            h.freq[p[0]] = f;
+            p += 9;
+        }
+        return true;
+    }
 
-    freeTree(root);
+    if (h.magic != HUFF_MAGIC_V2 && h.magic != HUFF_MAGIC_V3) return false;
+    p += sizeof(h.magic);
+    if (!readVarint(p, end, h.origSize)) return false;
+    if (h.magic == HUFF_MAGIC_V2) return true;
+    if (p == end) return false;
+    h.streams = *p++;
+    return h.streams == 1 || h.streams == 4;
 }
 
-/* Декодирование файла */
-static void decodeFile(const string& inPath, const string& outPath) {
-    /* 1) Открываем сжатый файл */
-    ifstream in(inPath, std::ios::binary);
-    if (!in) {
-        cerr << "Cannot open encoded file: " << inPath << "\n";
-        return;
+/* Дерево старых форматов на плоском массиве: у полного кода не больше 511 узлов */
+constexpr int LEGACY_TREE_MAX = 511;
+
+struct LegacyNode {
+    uint64_t freq{0};
+    array<int16_t, 2> child{{-1, -1}};
+    uint8_t sym{0};
+    bool leaf{false};
+};
+
+struct LegacyTree {
+    array<LegacyNode, LEGACY_TREE_MAX> nodes;
+    int count{0};
+    int root{0};
+};
+
+/* HFF1: то же дерево, что строила std::priority_queue — те же сравнения в той же куче */
+static void buildFrequencyTree(const array<uint64_t, 256>& freq, LegacyTree& t) {
+    array<int16_t, 256> heap{};
+    size_t size = 0;
+    auto later = [&](int a, int b) { return t.nodes[a].freq > t.nodes[b].freq; };
+
+    t.count = 0;
+    for (int s = 0; s < 256; s++) {
+        if (freq[s] == 0) continue;
+        LegacyNode& leaf = t.nodes[t.count];
+        leaf = LegacyNode{};
+        leaf.freq = freq[s];
+        leaf.sym = static_cast<uint8_t>(s);
+        leaf.leaf = true;
+        heap[size++] = static_cast<int16_t>(t.count++);
+        std::push_heap(heap.begin(), heap.begin() + size, later);
+    }
+
+    while (size > 1) {
+        std::pop_heap(heap.begin(), heap.begin() + size--, later);
+        const int16_t a = heap[size];
+        std::pop_heap(heap.begin(), heap.begin() + size--, later);
+        const int16_t b = heap[size];
+
+        LegacyNode& parent = t.nodes[t.count];
+        parent = LegacyNode{};
+        parent.freq = t.nodes[a].freq + t.nodes[b].freq;
+        parent.child = {{a, b}};
+        heap[size++] = static_cast<int16_t>(t.count++);
+        std::push_heap(heap.begin(), heap.begin() + size, later);
+    }
+    t.root = heap[0];
+}
+
+/* HFF2 с кодами длиннее MAX_CODE_LEN: канонические коды вставляются в дерево; false — длины не задают префиксный код */
+static bool buildCanonicalTree(const array<uint8_t, 256>& lens, LegacyTree& t) {
+    constexpr int LEN_MAX = 63;
+    array<uint32_t, LEN_MAX + 1> count{};
+    for (int s = 0; s < 256; s++) count[lens[s]]++;
+    count[0] = 0;
+
+    array<uint64_t, LEN_MAX + 1> next{};
+    uint64_t code = 0;
+    for (int len = 1; len <= LEN_MAX; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    t.nodes[0] = LegacyNode{};
+    t.count = 1;
+    t.root = 0;
+    for (int s = 0; s < 256; s++) {
+        if (lens[s] == 0) continue;
+        const uint64_t c = next[lens[s]]++;
+        int v = t.root;
+        for (int i = lens[s] - 1; i >= 0; i--) {
+            if (t.nodes[v].leaf) return false;
+            int16_t& child = t.nodes[v].child[(c >> i) & 1];
+            if (child < 0) {
+                if (t.count == LEGACY_TREE_MAX) return false;
+                t.nodes[t.count] = LegacyNode{};
+                child = static_cast<int16_t>(t.count++);
+            }
+            v = child;
+        }
+        if (t.nodes[v].leaf || t.nodes[v].child[0] >= 0 || t.nodes[v].child[1] >= 0) return false;
+        t.nodes[v].leaf = true;
+        t.nodes[v].sym = static_cast<uint8_t>(s);
+    }
+    return true;
+}
+
+/* Побитовый проход по дереву (старшим битом вперёд, как писал старый BitWriter); false — поток кончился или порчен */
+static bool decodeTreeWalk(const LegacyTree& t, const uint8_t* p, size_t size, uint8_t* dst, size_t n) {
+    const LegacyNode& root = t.nodes[t.root];
+    if (root.leaf) {
+        std::memset(dst, root.sym, n);
+        return true;
     }
 
-    /* 2) Читаем заголовок */
+    const uint64_t bits = uint64_t(size) * 8;
+    uint64_t pos = 0;
+    for (size_t i = 0; i < n; i++) {
+        int v = t.root;
+        while (!t.nodes[v].leaf) {
+            if (pos == bits) return false;
+            const int bit = (p[pos >> 3] >> (7 - (pos & 7))) & 1;
+            pos++;
+            v = t.nodes[v].child[bit];
+            if (v < 0) return false;
+        }
+        dst[i] = t.nodes[v].sym;
+    }
+    return true;
+}
+
+/* Распаковка старого формата после заголовка в dst из h.origSize байт */
+static bool decodeLegacy(const LegacyHeader& h, const uint8_t* p, const uint8_t* end, uint8_t* dst) {
+    const size_t n = static_cast<size_t>(h.origSize);
+    LegacyTree tree;
+    if (h.magic == HUFF_MAGIC_V1) {
+        buildFrequencyTree(h.freq, tree);
+        return decodeTreeWalk(tree, p, static_cast<size_t>(end - p), dst, n);
+    }
+
+    /* HFF2 и HFF3 — тело блока нынешнего формата, пока коды не длиннее MAX_CODE_LEN */
+    const uint8_t* q = p;
+    array<uint8_t, 256> lens{};
+    if (!readLengths(q, end, lens)) return false;
+    if (*std::max_element(lens.begin(), lens.end()) <= MAX_CODE_LEN) {
+        return decodeBlock(p, static_cast<size_t>(end - p), h.streams, dst, n);
+    }
+    if (h.magic != HUFF_MAGIC_V2 || !buildCanonicalTree(lens, tree)) return false;
+    return decodeTreeWalk(tree, q, static_cast<size_t>(end - q), dst, n);
+}
+
+/*
+ * Библиотечный интерфейс: сжатие и распаковка из буфера в буфер, без файлов
+ * и потоков ввода-вывода; буфер результата выделяет вызывающий.
+ * Формат: magic | varint размер | varint размер блока | потоков (1 байт) | блоки.
+ * Блок: varint длина | таблица длин | [таблица переходов] | потоки.
+ * У каждого блока своя таблица, поэтому блоки сжимаются и распаковываются
+ * параллельно — волнами по BLOCK_WAVE, планы волны лежат на стеке. При
+ * opt.threads == 1 память не выделяется вовсе.
+ */
+constexpr size_t HUFF_HEADER_MAX = sizeof(HUFF_MAGIC) + 10 + 10 + 1;
+constexpr size_t BLOCK_WAVE = 64;
+
+/*
+ * Худший размер блока сверх его данных: префикс длины, таблица длин (не больше
+ * байта на символ), таблица переходов и добивка четырёх потоков до байта.
+ * Код Хаффмана (и с ограничением длины) не длиннее 8 бит в среднем.
+ */
+constexpr size_t BLOCK_OVERHEAD = 5 + 256 + 3 * 5 + 4;
+
+/* Худший размер сжатых данных; 0 — недопустимые параметры */
+size_t compressBound(size_t n, const HuffOptions& opt) {
+    if (!validOptions(opt)) return 0;
+    const size_t blockCount = (n + opt.blockSize - 1) / opt.blockSize;
+    return HUFF_HEADER_MAX + n + blockCount * BLOCK_OVERHEAD;
+}
+
+/* Сжатие n байт в dst; false — недопустимые параметры или не хватило capacity (compressBound хватает всегда) */
+bool compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity,
+              const HuffOptions& opt, size_t& written) {
+    if (!validOptions(opt)) return false;
+    const size_t blockCount = (n + opt.blockSize - 1) / opt.blockSize;
+    WorkerPool pool(resolveThreads(opt.threads));
+    auto blockLen = [&](size_t b) { return std::min(opt.blockSize, n - b * opt.blockSize); };
+
+    /* 1) Заголовок */
+    array<uint8_t, HUFF_HEADER_MAX> header{};
+    uint8_t* h = header.data();
+    std::memcpy(h, &HUFF_MAGIC, sizeof(HUFF_MAGIC));
+    h = putVarint(h + sizeof(HUFF_MAGIC), n);
+    h = putVarint(h, opt.blockSize);
+    *h++ = static_cast<uint8_t>(opt.streams);
+
+    size_t total = static_cast<size_t>(h - header.data());
+    if (total > capacity) return false;
+    std::memcpy(dst, header.data(), total);
+
+    /* 2) Волнами: параллельно частоты, длины кодов и точный размер блоков,
+          затем смещения и кодирование каждого блока прямо на своё место */
+    array<BlockPlan, BLOCK_WAVE> plans;
+    for (size_t first = 0; first < blockCount; first += BLOCK_WAVE) {
+        const size_t count = std::min(BLOCK_WAVE, blockCount - first);
+        pool.run(count, [&](size_t k) {
+            planBlock(src + (first + k) * opt.blockSize, blockLen(first + k), opt, plans[k]);
+        });
+
+        for (size_t k = 0; k < count; k++) {
+            plans[k].offset = total;
+            total += varintSize(plans[k].size) + plans[k].size;
+        }
+        if (total > capacity) return false;
+
+        pool.run(count, [&](size_t k) {
+            emitBlock(src + (first + k) * opt.blockSize, blockLen(first + k), opt, plans[k], dst + plans[k].offset);
+        });
+    }
+
+    written = total;
+    return true;
+}
+
+/* Разбор заголовка: размер исходных данных, размер блока, число потоков */
+static bool readHeader(const uint8_t*& p, const uint8_t* end, uint64_t& origSize,
+                       uint64_t& blockSize, int& streams) {
     uint32_t magic = 0;
+    if (static_cast<size_t>(end - p) < sizeof(magic)) return false;
+    std::memcpy(&magic, p, sizeof(magic));
+    p += sizeof(magic);
+    if (magic != HUFF_MAGIC || !readVarint(p, end, origSize) || !readVarint(p, end, blockSize) || p == end) {
+        return false;
+    }
+
+    streams = *p++;
+    return (streams == 1 || streams == 4) && blockSize >= MIN_BLOCK_SIZE && blockSize <= MAX_BLOCK_SIZE;
+}
+
+/* Размер распакованных данных по заголовку; false — это не сжатый нами буфер */
+bool decompressedSize(const uint8_t* src, size_t size, uint64_t& origSize) {
+    LegacyHeader legacy;
+    const uint8_t* p = src;
+    if (readLegacyHeader(p, src + size, legacy)) {
+        origSize = legacy.origSize;
+        return true;
+    }
+
+    uint64_t blockSize = 0;
+    int streams = 0;
+    return readHeader(src, src + size, origSize, blockSize, streams);
+}
+
+/* Распаковка в dst; false — данные повреждены или не хватило capacity */
+bool decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity,
+                const HuffOptions& opt, size_t& written) {
+    const uint8_t* p = src;
+    const uint8_t* end = src + size;
+
+    /* 0) Старые форматы: один блок, распаковка в одном потоке */
+    LegacyHeader legacy;
+    if (readLegacyHeader(p, end, legacy)) {
+        if (legacy.origSize > capacity || !decodeLegacy(legacy, p, end, dst)) return false;
+        written = static_cast<size_t>(legacy.origSize);
+        return true;
+    }
+    p = src;
+
+    /* 1) Заголовок; каждый блок занимает хотя бы байт */
     uint64_t origSize = 0;
-    uint16_t uniqueCount = 0;
+    uint64_t blockSize = 0;
+    int streams = 0;
+    if (!readHeader(p, end, origSize, blockSize, streams) || origSize > capacity) return false;
 
-    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
-    in.read(reinterpret_cast<char*>(&origSize), sizeof(origSize));
-    in.read(reinterpret_cast<char*>(&uniqueCount), sizeof(uniqueCount));
+    const size_t outSize = static_cast<size_t>(origSize);
+    const size_t blockCount = static_cast<size_t>((origSize + blockSize - 1) / blockSize);
+    if (blockCount > static_cast<size_t>(end - p)) return false;
 
-    if (!in || magic != 0x48464631) {
-        cerr << "Bad format.\n";
-        return;
+    /* 2) Волнами: границы блоков, затем параллельная распаковка каждого на своё место */
+    WorkerPool pool(resolveThreads(opt.threads));
+    array<const uint8_t*, BLOCK_WAVE> blockPtr{};
+    array<size_t, BLOCK_WAVE> blockBytes{};
+    array<uint8_t, BLOCK_WAVE> ok{};
+
+    for (size_t first = 0; first < blockCount; first += BLOCK_WAVE) {
+        const size_t count = std::min(BLOCK_WAVE, blockCount - first);
+        for (size_t k = 0; k < count; k++) {
+            uint64_t sz = 0;
+            if (!readVarint(p, end, sz) || sz > static_cast<uint64_t>(end - p)) return false;
+            blockPtr[k] = p;
+            blockBytes[k] = static_cast<size_t>(sz);
+            p += sz;
+        }
+
+        pool.run(count, [&](size_t k) {
+            size_t from = (first + k) * static_cast<size_t>(blockSize);
+            size_t len = std::min(static_cast<size_t>(blockSize), outSize - from);
+            ok[k] = decodeBlock(blockPtr[k], blockBytes[k], streams, dst + from, len);
+        });
+        for (size_t k = 0; k < count; k++) {
+            if (!ok[k]) return false;
+        }
     }
 
-    /* 3) Читаем таблицу частот */
-    array<uint64_t, 256> freq{};
-    for (uint16_t i = 0; i < uniqueCount; i++) {
-        char symC;
-        uint64_t f;
-        in.get(symC);
-        in.read(reinterpret_cast<char*>(&f), sizeof(uint64_t));
-        freq[static_cast<uint8_t>(symC)] = f;
-    }
-
-    /* 4) Восстанавливаем дерево по частотам */
-    uint16_t dummyUnique = 0;
-    Node* root = buildHuffmanTree(freq, dummyUnique);
-    if (!root) {
-        cerr << "Tree build error.\n";
-        return;
+    written = outSize;
+    return true;
+}
+
+/*
+ * Потоковый интерфейс в духе z_stream: вызывающий подаёт вход кусками любого
+ * размера и забирает выход в буферы фиксированного размера.
+ * Формат: magic "HFS1" | varint размер блока | потоков (1 байт) | кадры.
+ * Кадр: varint длина исходных данных (до размера блока) | блок, как в
+ * compress (с префиксом длины); нулевая длина — конец потока. Кадр
+ * закрывается по заполнению блока или по Flush, так что всё поданное до
+ * Flush распаковывается без остального потока. В памяти — один блок входа
+ * и один выхода; размер всего входа заранее не нужен.
+ */
+enum class StreamFlush { None, Flush, Finish };
+enum class StreamStatus { Ok, End, Error };
+
+struct StreamIo {
+    const uint8_t* nextIn{nullptr};
+    size_t availIn{0};
+    uint8_t* nextOut{nullptr};
+    size_t availOut{0};
+};
+
+/* Отдаём накопленный выход; true — отдан целиком */
+static bool drainStream(std::vector<uint8_t>& out, size_t& outPos, StreamIo& io) {
+    const size_t take = std::min(out.size() - outPos, io.availOut);
+    if (take > 0) std::memcpy(io.nextOut, out.data() + outPos, take);
+    io.nextOut += take;
+    io.availOut -= take;
+    outPos += take;
+    if (outPos < out.size()) return false;
+    out.clear();
+    outPos = 0;
+    return true;
+}
+
+class CompressStream {
+public:
+    /* Заголовок потока; false — недопустимые параметры */
+    bool init(const HuffOptions& opt) {
+        opt_ = opt;
+        ready_ = validOptions(opt);
+        pending_.clear();
+        out_.resize(HUFF_HEADER_MAX);
+        outPos_ = 0;
+        finished_ = false;
+
+        uint8_t* h = out_.data();
+        std::memcpy(h, &HUFF_STREAM_MAGIC, sizeof(HUFF_STREAM_MAGIC));
+        h = putVarint(h + sizeof(HUFF_STREAM_MAGIC), opt.blockSize);
+        *h++ = static_cast<uint8_t>(opt.streams);
+        out_.resize(static_cast<size_t>(h - out_.data()));
+        return ready_;
+    }
+
+    /*
+     * Забирает вход и отдаёт выход, пока есть и то, и другое. None — кадры
+     * закрываются по заполнению блока; Flush — ещё и по концу входа; Finish —
+     * конец потока: End, когда выход отдан целиком. Вызывать снова, пока availOut == 0.
+     */
+    StreamStatus compress(StreamIo& io, StreamFlush flush) {
+        if (!ready_) return StreamStatus::Error;
+
+        for (;;) {
+            if (!drainStream(out_, outPos_, io)) return StreamStatus::Ok;
+            if (finished_) return StreamStatus::End;
+
+            if (io.availIn > 0) {
+                const size_t take = std::min(io.availIn, opt_.blockSize - pending_.size());
+                pending_.insert(pending_.end(), io.nextIn, io.nextIn + take);
+                io.nextIn += take;
+                io.availIn -= take;
+                if (pending_.size() == opt_.blockSize) emitFrame();
+                continue;
+            }
+
+            /* Вход кончился: по Flush и Finish закрываем начатый блок */
+            if (flush == StreamFlush::None) return StreamStatus::Ok;
+            if (!pending_.empty()) {
+                emitFrame();
+                continue;
+            }
+            if (flush == StreamFlush::Flush) return StreamStatus::Ok;
+            out_.push_back(0);
+            finished_ = true;
+        }
+    }
+
+private:
+    void emitFrame() {
+        const size_t n = pending_.size();
+        planBlock(pending_.data(), n, opt_, plan_);
+        out_.resize(varintSize(n) + varintSize(plan_.size) + plan_.size);
+        uint8_t* p = putVarint(out_.data(), n);
+        emitBlock(pending_.data(), n, opt_, plan_, p);
+        pending_.clear();
+    }
+
+    HuffOptions opt_;
+    BlockPlan plan_;
+    std::vector<uint8_t> pending_;      // вход текущего блока
+    std::vector<uint8_t> out_;          // выход, ещё не отданный вызывающему
+    size_t outPos_{0};
+    bool ready_{false};
+    bool finished_{false};
+};
+
+class DecompressStream {
+public:
+    void init() {
+        in_.clear();
+        out_.clear();
+        outPos_ = 0;
+        blockSize_ = 0;
+        streams_ = 0;
+        finished_ = false;
+    }
+
+    /*
+     * Забирает вход, пока не соберёт заголовок или кадр целиком, и отдаёт
+     * распакованное. End — конец потока и весь выход отдан; вход за концом
+     * остаётся в io. Error — не наш поток или порча.
+     */
+    StreamStatus decompress(StreamIo& io) {
+        for (;;) {
+            if (!drainStream(out_, outPos_, io)) return StreamStatus::Ok;
+            if (finished_) return StreamStatus::End;
+
+            size_t need = 0;
+            if (!step(need)) return StreamStatus::Error;
+            if (need == 0) continue;
+
+            /* Не хватает входа: берём ровно до need байт */
+            if (io.availIn == 0) return StreamStatus::Ok;
+            const size_t take = std::min(io.availIn, need - in_.size());
+            in_.insert(in_.end(), io.nextIn, io.nextIn + take);
+            io.nextIn += take;
+            io.availIn -= take;
+        }
     }
 
-    /* 5) Открываем выходной файл */
-    ofstream out(outPath, std::ios::binary);
+private:
+    /* Шаг разбора накопленного входа; need != 0 — сколько байт нужно в in_ для шага */
+    bool step(size_t& need) {
+        const uint8_t* p = in_.data();
+        const uint8_t* end = p + in_.size();
+
+        if (streams_ == 0) {
+            /* Заголовок: magic, размер блока, число потоков */
+            uint32_t magic = 0;
+            uint64_t blockSize = 0;
+            if (in_.size() < sizeof(magic)) {
+                need = sizeof(magic);
+                return true;
+            }
+            std::memcpy(&magic, p, sizeof(magic));
+            if (magic != HUFF_STREAM_MAGIC) return false;
+            p += sizeof(magic);
+            if (!readVarint(p, end, blockSize) || p == end) {
+                need = in_.size() + 1;
+                return in_.size() < HUFF_HEADER_MAX;
+            }
+            const int streams = *p++;
+            if ((streams != 1 && streams != 4) || blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE) return false;
+            blockSize_ = static_cast<size_t>(blockSize);
+            streams_ = streams;
+            in_.erase(in_.begin(), in_.begin() + (p - in_.data()));
+            return true;
+        }
+
+        /* Кадр: длина исходных данных, затем блок с префиксом длины */
+        uint64_t n = 0, blockBytes = 0;
+        if (!readVarint(p, end, n)) {
+            need = in_.size() + 1;
+            return in_.size() < 10;
+        }
+        if (n == 0) {
+            finished_ = true;
+            return true;
+        }
+        if (n > blockSize_) return false;
+        if (!readVarint(p, end, blockBytes)) {
+            need = in_.size() + 1;
+            return in_.size() < 20;
+        }
+        if (blockBytes > n + BLOCK_OVERHEAD) return false;
+
+        const size_t head = static_cast<size_t>(p - in_.data());
+        if (static_cast<uint64_t>(end - p) < blockBytes) {
+            need = head + static_cast<size_t>(blockBytes);
+            return true;
+        }
+
+        out_.resize(static_cast<size_t>(n));
+        if (!decodeBlock(p, static_cast<size_t>(blockBytes), streams_, out_.data(), out_.size())) return false;
+        in_.erase(in_.begin(), in_.begin() + static_cast<std::ptrdiff_t>(head + blockBytes));
+        return true;
+    }
+
+    std::vector<uint8_t> in_;           // накопленный вход: заголовок или один кадр
+    std::vector<uint8_t> out_;          // распакованный блок, ещё не отданный
+    size_t outPos_{0};
+    size_t blockSize_{0};
+    int streams_{0};                    // 0 — заголовок ещё не разобран
+    bool finished_{false};
+};
+
+}  // namespace huff
+
+#ifndef HUFF_NO_MAIN
+using namespace huff;
+
+/* Прокачка через потоковый интерфейс буферами по STREAM_IO байт: годятся каналы */
+constexpr size_t STREAM_IO = size_t(1) << 16;
+
+static bool encodeFramed(std::istream& in, const HuffOptions& opt, std::ostream& out, uint64_t& n, uint64_t& written) {
+    CompressStream zs;
+    if (!zs.init(opt)) return false;
+    std::vector<uint8_t> inBuf(STREAM_IO), outBuf(STREAM_IO);
+    n = 0;
+    written = 0;
+    StreamFlush flush = StreamFlush::None;
+    StreamIo io;
+    for (;;) {
+        if (io.availIn == 0 && flush == StreamFlush::None) {
+            in.read(reinterpret_cast<char*>(inBuf.data()), static_cast<std::streamsize>(inBuf.size()));
+            io.nextIn = inBuf.data();
+            io.availIn = static_cast<size_t>(in.gcount());
+            n += io.availIn;
+            if (in.bad()) return false;         // ошибка чтения — не конец входа: конечный кадр не пишем
+            if (!in) flush = StreamFlush::Finish;
+        }
+        io.nextOut = outBuf.data();
+        io.availOut = outBuf.size();
+        const StreamStatus st = zs.compress(io, flush);
+        const size_t got = outBuf.size() - io.availOut;
+        out.write(reinterpret_cast<const char*>(outBuf.data()), static_cast<std::streamsize>(got));
+        written += got;
+        if (st == StreamStatus::Error) return false;
+        if (st == StreamStatus::End) return static_cast<bool>(out);
+    }
+}
+
+/* Распаковка кадров; head — байты, уже прочитанные ради magic */
+static bool decodeFramed(std::istream& in, const uint8_t* head, size_t headSize, std::ostream& out) {
+    DecompressStream zs;
+    zs.init();
+    std::vector<uint8_t> inBuf(STREAM_IO), outBuf(STREAM_IO);
+    StreamIo io;
+    io.nextIn = head;
+    io.availIn = headSize;
+    for (;;) {
+        if (io.availIn == 0) {
+            in.read(reinterpret_cast<char*>(inBuf.data()), static_cast<std::streamsize>(inBuf.size()));
+            io.nextIn = inBuf.data();
+            io.availIn = static_cast<size_t>(in.gcount());
+            if (io.availIn == 0) return false;     // поток оборван до конца
+        }
+        io.nextOut = outBuf.data();
+        io.availOut = outBuf.size();
+        const StreamStatus st = zs.decompress(io);
+        out.write(reinterpret_cast<const char*>(outBuf.data()), static_cast<std::streamsize>(outBuf.size() - io.availOut));
+        if (st == StreamStatus::Error) return false;
+        if (st == StreamStatus::End) return static_cast<bool>(out);
+    }
+}
+
+/* Вход и выход — один файл (в том числе под другим путём): выход затёр бы вход */
+static bool samePath(const string& a, const string& b) {
+    std::error_code ec;
+    return std::filesystem::equivalent(a, b, ec);
+}
+
+/* Кодирование через потоковый интерфейс: вход и выход читаются и пишутся последовательно */
+static bool encodeFileStreamed(const string& inPath, const string& outPath, const HuffOptions& opt) {
+    if (samePath(inPath, outPath)) {
+        cerr << "Input and output must be different files.\n";
+        return false;
+    }
+
+    std::ifstream in(inPath, std::ios::binary);
+    if (!in) {
+        cerr << "Cannot open input: " << inPath << "\n";
+        return false;
+    }
+    if (in.peek() == std::ifstream::traits_type::eof()) {
+        cerr << "Input is empty.\n";
+        return false;
+    }
+    std::ofstream out(outPath, std::ios::binary);
     if (!out) {
         cerr << "Cannot create output: " << outPath << "\n";
-        freeTree(root);
-        return;
+        return false;
     }
 
-    /* 6) Частный случай: один символ во всём файле */
-    if (root->is_leaf) {
-        for (uint64_t i = 0; i < origSize; i++) out.put(static_cast<char>(root->ch));
+    uint64_t inSz = 0, outSz = 0;
+    if (!encodeFramed(in, opt, out, inSz, outSz)) {
+        if (in.bad()) cerr << "Read error: " << inPath << "\n";
+        else cerr << "Write error: " << outPath << "\n";
         out.close();
-        freeTree(root);
-        cout << "Decoded OK\n";
-        return;
+        std::filesystem::remove(outPath);
+        return false;
     }
 
-    /* 7) Читаем биты и идём по дереву до восстановления origSize байт */
-    BitReader br(in);
-    Node* cur = root;
-    uint64_t written = 0;
+    double ratio = (1.0 - (double)outSz / (double)inSz) * 100.0;
+    cout << "Encoded OK\n";
+    cout << "Input:  " << inSz << " bytes\n";
+    cout << "Output: " << outSz << " bytes\n";
+    cout << "Compression: " << ratio << "%\n";
+    return true;
+}
 
-    while (written < origSize) {
-        bool bit;
-        if (!br.readBit(bit)) {
-            cerr << "Unexpected EOF in bitstream.\n";
-            break;
-        }
+/* Кодирование файла: выход отображается с запасом compressBound и обрезается */
+static bool encodeFile(const string& inPath, const string& outPath, const HuffOptions& opt) {
+    if (samePath(inPath, outPath)) {
+        cerr << "Input and output must be different files.\n";
+        return false;
+    }
+
+    /* 1) Отображаем входной файл в память */
+    MappedFile data;
+
+    if (!data.open(inPath)) {
+        cerr << "Cannot open input: " << inPath << "\n";
+        return false;
+    }
+    if (data.size() == 0) {
+        cerr << "Input is empty.\n";
+        return false;
+    }
+
+    /* 2) Сжимаем прямо в отображённый выходной файл */
+    const size_t n = data.size();
+    const size_t bound = compressBound(n, opt);
+    MappedOutput out;
+    if (!out.create(outPath, bound)) {
+        cerr << "Cannot create output: " << outPath << "\n";
+        return false;
+    }
+
+    size_t total = 0;
+    if (!compress(data.data(), n, out.data(), bound, opt, total)) {
+        cerr << "Compression failed.\n";
+        out.finish(0);
+        std::filesystem::remove(outPath);
+        return false;
+    }
+
+    if (!out.finish(total)) {
+        cerr << "Write error: " << outPath << "\n";
+        return false;
+    }
+
+    /* 3) Вывод статистики */
+    uint64_t inSz = static_cast<uint64_t>(n);
+    uint64_t outSz = static_cast<uint64_t>(total);
+    double ratio = (1.0 - (double)outSz / (double)inSz) * 100.0;
+
+    cout << "Encoded OK\n";
+    cout << "Input:  " << inSz << " bytes\n";
+    cout << "Output: " << outSz << " bytes\n";
+    cout << "Compression: " << ratio << "%\n";
+    cout << "Blocks: " << (n + opt.blockSize - 1) / opt.blockSize << ", threads: " << resolveThreads(opt.threads) << "\n";
+    return true;
+}
 
-        cur = bit ? cur->right : cur->left;
+/* Декодирование файла */
+static bool decodeFile(const string& inPath, const string& outPath, const HuffOptions& opt) {
+    if (samePath(inPath, outPath)) {
+        cerr << "Input and output must be different files.\n";
+        return false;
+    }
 
-        if (cur->is_leaf) {
-            out.put(static_cast<char>(cur->ch));
-            written++;
-            cur = root;
+    /* 0) Поток из кадров читается и пишется последовательно */
+    {
+        std::ifstream in(inPath, std::ios::binary);
+        uint32_t magic = 0;
+        if (in.read(reinterpret_cast<char*>(&magic), sizeof(magic)) && magic == HUFF_STREAM_MAGIC) {
+            std::ofstream out(outPath, std::ios::binary);
+            if (!out) {
+                cerr << "Cannot create output: " << outPath << "\n";
+                return false;
+            }
+            if (!decodeFramed(in, reinterpret_cast<const uint8_t*>(&magic), sizeof(magic), out)) {
+                cerr << "Corrupted data.\n";
+                out.close();
+                std::filesystem::remove(outPath);
+                return false;
+            }
+            cout << "Decoded OK\n";
+            return true;
         }
     }
 
-    out.close();
-    freeTree(root);
+    /* 1) Отображаем сжатый файл в память */
+    MappedFile enc;
+    if (!enc.open(inPath)) {
+        cerr << "Cannot open encoded file: " << inPath << "\n";
+        return false;
+    }
+
+    /* 2) Размер результата из заголовка */
+    uint64_t origSize = 0;
+    if (!decompressedSize(enc.data(), enc.size(), origSize)) {
+        cerr << "Bad format.\n";
+        return false;
+    }
+
+    /* 3) Отображаем выходной файл и распаковываем блоки прямо в него */
+    const size_t outSize = static_cast<size_t>(origSize);
+    MappedOutput out;
+    if (!out.create(outPath, outSize)) {
+        cerr << "Cannot create output: " << outPath << "\n";
+        return false;
+    }
+
+    size_t written = 0;
+    if (!decompress(enc.data(), enc.size(), out.data(), outSize, opt, written)) {
+        cerr << "Corrupted data.\n";
+        out.finish(0);
+        std::filesystem::remove(outPath);
+        return false;
+    }
+
+    if (!out.finish(outSize)) {
+        cerr << "Write error: " << outPath << "\n";
+        return false;
+    }
+
+    cout << "Decoded OK\n";
+    return true;
+}
 
-    if (written == origSize) cout << "Decoded OK\n";
-    else cout << "Decoded with mismatch: " << written << "/" << origSize << "\n";
+/* Размер с необязательным суффиксом K или M: 128K, 4M */
+static size_t parseSize(const string& s) {
+    char* rest = nullptr;
+    unsigned long long v = std::strtoull(s.c_str(), &rest, 10);
+    if (*rest == 'K' || *rest == 'k') v <<= 10;
+    else if (*rest == 'M' || *rest == 'm') v <<= 20;
+    return static_cast<size_t>(v);
 }
 
-/* Меню программы: выбор режима и ввод имён файлов */
-int main() {
+/*
+ * Меню программы: выбор режима и ввод имён файлов.
+ * Флаги: --max-len N — предел длины кода, --streams 1|4 — число потоков в блоке,
+ *        --block-size N[K|M] — размер блока, --threads N — число рабочих потоков,
+ *        --stream — кадры потокового интерфейса (вход читается последовательно).
+ */
+int main(int argc, char** argv) {
+    HuffOptions opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--max-len" && i + 1 < argc) {
+            opt.maxCodeLen = std::atoi(argv[++i]);
+        } else if (arg == "--streams" && i + 1 < argc) {
+            opt.streams = std::atoi(argv[++i]);
+        } else if (arg == "--block-size" && i + 1 < argc) {
+            opt.blockSize = parseSize(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            opt.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--stream") {
+            opt.stream = true;
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (opt.maxCodeLen < MIN_CODE_LEN || opt.maxCodeLen > MAX_CODE_LEN) {
+        cerr << "--max-len must be in " << MIN_CODE_LEN << ".." << MAX_CODE_LEN << "\n";
+        return 1;
+    }
+    if (opt.streams != 1 && opt.streams != 4) {
+        cerr << "--streams must be 1 or 4\n";
+        return 1;
+    }
+    if (opt.blockSize < MIN_BLOCK_SIZE || opt.blockSize > MAX_BLOCK_SIZE) {
+        cerr << "--block-size must be in 1K..1024M\n";
+        return 1;
+    }
+
     cout << "1) Encode (Huffman)\n2) Decode (Huffman)\nChoose: ";
     int choice = 0;
     std::cin >> choice;
@@ -339,9 +1804,12 @@ int main() {
     cout << "Output file: ";
     std::cin >> outFile;
 
-    if (choice == 1) encodeFile(inFile, outFile);
-    else if (choice == 2) decodeFile(inFile, outFile);
+    bool ok = false;
+    if (choice == 1 && opt.stream) ok = encodeFileStreamed(inFile, outFile, opt);
+    else if (choice == 1) ok = encodeFile(inFile, outFile, opt);
+    else if (choice == 2) ok = decodeFile(inFile, outFile, opt);
     else cout << "Wrong choice\n";
 
-    return 0;
+    return ok ? 0 : 1;
 }
+#endif
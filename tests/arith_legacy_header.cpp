@@ -0,0 +1,70 @@
+/*
+ * Регрессия: заголовок старого формата ARC1 с частотами, сумма которых
+ * переполняет 32 бита (0xFFFFFFFF + 2 -> 1), должен отвергаться, а не
+ * строить таблицу поиска за пределами массива.
+ * Сборка: g++ -std=c++17 -O1 -fsanitize=address,undefined -pthread tests/arith_legacy_header.cpp
+ */
+#define ARITH_NO_MAIN
+#include "../Arrifmetic_coding.cpp"
+
+using namespace arith;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        cerr << "FAIL: " << what << "\n";
+        failures++;
+    }
+}
+
+/* ARC1: magic | u32 размер | u32 частоты[256] | u64 число бит | поток */
+static std::vector<uint8_t> legacyHeader(const array<uint32_t, 256>& freq, uint32_t origSize) {
+    std::vector<uint8_t> buf(8 + sizeof(uint32_t) * 256 + sizeof(uint64_t) + 64, 0);
+    const uint32_t magic = MAGIC_BIT;
+    const uint64_t bits = 64 * 8;
+    std::memcpy(buf.data(), &magic, sizeof(magic));
+    std::memcpy(buf.data() + 4, &origSize, sizeof(origSize));
+    std::memcpy(buf.data() + 8, freq.data(), sizeof(uint32_t) * 256);
+    std::memcpy(buf.data() + 8 + sizeof(uint32_t) * 256, &bits, sizeof(bits));
+    return buf;
+}
+
+int main() {
+    array<uint8_t, 16> dst{};
+    size_t written = 0;
+
+    for (SymbolSearch search : {SymbolSearch::Linear, SymbolSearch::Binary, SymbolSearch::Simd, SymbolSearch::Table}) {
+        ArithOptions opt;
+        opt.threads = 1;
+        opt.search = search;
+
+        array<uint32_t, 256> freq{};
+        freq[0] = 0xFFFFFFFFu;
+        freq[1] = 2;
+        std::vector<uint8_t> wrapped = legacyHeader(freq, 16);
+        check(!decompress(wrapped.data(), wrapped.size(), dst.data(), dst.size(), opt, written),
+              "sum wrapping 32 bits is rejected");
+
+        freq = {};
+        std::vector<uint8_t> empty = legacyHeader(freq, 16);
+        check(!decompress(empty.data(), empty.size(), dst.data(), dst.size(), opt, written),
+              "zero sum is rejected");
+
+        freq[0] = 1u << 30;
+        freq[1] = 1;
+        std::vector<uint8_t> wide = legacyHeader(freq, 16);
+        check(!decompress(wide.data(), wide.size(), dst.data(), dst.size(), opt, written),
+              "sum above a quarter of the interval is rejected");
+
+        freq = {};
+        freq['a'] = 3;
+        freq['b'] = 1;
+        std::vector<uint8_t> valid = legacyHeader(freq, 16);
+        check(decompress(valid.data(), valid.size(), dst.data(), dst.size(), opt, written) && written == 16,
+              "small valid legacy header still decodes");
+    }
+
+    if (failures == 0) cout << "OK\n";
+    return failures == 0 ? 0 : 1;
+}